@@ -24,18 +24,15 @@
 
 #define _GNU_SOURCE
 
-#include "rj.h"
-#include <sys/queue.h>
+#include "rj_private.h"
+#include <pthread.h>
+#include <unistd.h>
+#include <fcntl.h>
 #include <stdlib.h>
-#include <stdio.h>
 #include <string.h>
 #include <errno.h>
 
-#ifndef NDEBUG
-#   define DEBUG(x) x
-#else
-#   define DEBUG(x) while(0)
-#endif
+#define SAVE_CHUNK 4096
 
 #define PREV_FIELD   1
 #define PREV_COMMENT 2
@@ -54,25 +51,12 @@
 #define MOD_DEL (1<<8)
 #define MOD_DEL_REC (1<<9)
 
-int trim(char** str);
-int escape(char** dest, const char* src, const char* delim);
-int escape_rev(char** dest, const char* src, const char* delim);
 char* mod(int mode, const char* key, const char* keyval,
     const char* field, const char* elem1, const char* elem2, struct recordjar* rj);
-
-struct chain_field
-{
-    TAILQ_ENTRY(chain_field) chain;
-    char *field, *value;
-};
-TAILQ_HEAD(record, chain_field);
-
-struct chain_record
-{
-    CIRCLEQ_ENTRY(chain_record) chain;
-    struct record rec;
-};
-CIRCLEQ_HEAD(jar, chain_record);
+char* mod_apply(int mode, struct chain_record* r, struct chain_field* modf,
+    const char* field, const char* elem1, const char* elem2, struct recordjar* rj);
+char* mod_static(int mode, const char* key, const char* keyval,
+    const char* field, const char* def, struct recordjar* rj);
 
 
 void rj_init(struct recordjar *rj)
@@ -91,201 +75,123 @@ int rj_load(const char* file, struct recordjar* rj)
     rj_init(rj);
     
     struct jar* j = rj->jar;
-
-    struct chain_record *cr = malloc(sizeof(struct chain_record));
-    CIRCLEQ_INSERT_TAIL(j, cr, chain);
-    rj->rec = cr;
-    
-    struct record* r = &cr->rec;
-    TAILQ_INIT(r);
+    struct parser p;
+    int ret = 0;
     
-    char* line = 0;
-    size_t size;
-    int count, prevtype = 0, encoding = 0;
-    struct chain_field* f;
+    memset(&p, 0, sizeof(struct parser));
+    p.fp = fp;
     
-    while((count = getline(&line, &size, fp)) != -1)
+    while(!p.eof)
     {
-        if(!encoding)
-        {
-            encoding = 1;
-            if(count >= 2 && line[0] == '%' && line[1] == '%')
-            {
-                DEBUG(printf("[RJ] check encoding\n"));
-                char* enc = line+2;
-                char* field = strtok(enc, ":");
-                char* value = strtok(0, ":");
-                if(field[0] == ':' || !value)
-                    DEBUG(printf("  no encoding signature\n"));
-                else
-                {
-                    trim(&field);
-                    if(!strcmp(field, "encoding"))
-                    {
-                        if(trim(&value))
-                        {
-                            if(!strcmp(value, "US-ASCII"))
-                            {
-                                DEBUG(printf("  US-ASCII\n"));
-                                continue;
-                            }
-                            else
-                            {
-                                DEBUG(printf("  no supported encoding signature\n"));
-                                return RJ_ERROR_ENCODING_UNSUPPORTED;
-                            }
-                        }
-                        else
-                        {
-                            DEBUG(printf("  invalid encoding signature\n"));
-                            return RJ_ERROR_ENCODING_INVALID;
-                        }
-                    }
-                    else
-                        DEBUG(printf("  no encoding signature\n"));
-                }
-            }
-        }
-        
-        if(count == 1 && line[0] == '\n')
-            DEBUG(printf("[RJ] ignored newline\n"));
-        else if(count >= 1 && (line[0] == ' ' || line[0] == '\t'))
-        {
-            DEBUG(printf("[RJ] fold line\n"));
-            if(prevtype == PREV_FIELD)
-            {
-                char* value = line;
-                int newlen = trim(&value);
-                if(value[newlen-1] == '\\')
-                {
-                    DEBUG(printf("  continued\n"));
-                    value[newlen-1] = 0;
-                    --newlen;
-                }
-                escape_rev(&f->value, value, ""); // append
-            }
-            else
-                DEBUG(printf("  error beginning fold line\n"));
-        }
-        else if(count >= 2 && line[0] == '%' && line[1] == '%')
-        {
-            DEBUG(printf("[RJ] comment\n"));
-            if(prevtype == PREV_FIELD)
-            {
-                DEBUG(printf("  new record\n"));
-                struct chain_record *cr = (struct chain_record*) malloc(sizeof(struct chain_record));
-                CIRCLEQ_INSERT_TAIL(j, cr, chain);
-                r = &cr->rec;
-                TAILQ_INIT(r);
-            }
-            prevtype = PREV_COMMENT;
-        }
+        struct chain_record* cr = new_record(rj);
+        CIRCLEQ_INSERT_TAIL(j, cr, chain);
+        if((ret = parse_record(&p, &cr->rec, 0)) > 0)
+            ++rj->size;
         else
         {
-            DEBUG(printf("[RJ] field\n"));
-            char* value;
-            char* field = strtok_r(line, ":", &value);
-            
-            if(field[0] == ':' || !value)
-                DEBUG(printf("  error no field name\n"));
-            else
-            {
-                int fieldlen = trim(&field);
-                int valuelen = trim(&value);
-                if(!valuelen)
-                    DEBUG(printf("  error no value\n"));
-                else
-                {
-                    if(value[valuelen-1] == '\\')
-                    {
-                        DEBUG(printf("  continued\n"));
-                        value[valuelen-1] = 0;
-                        --valuelen;
-                    }
-                    
-                    f = (struct chain_field*) malloc(sizeof(struct chain_field));
-                    TAILQ_INSERT_TAIL(r, f, chain);
-                    f->field = (char*) malloc((fieldlen+1)*sizeof(char));
-                    strcpy(f->field, field);
-                    f->value = 0;
-                    escape_rev(&f->value, value, 0); // overwrite
-                    
-                    if(!rj->size || prevtype == PREV_COMMENT)
-                        ++rj->size;
-                    
-                    prevtype = PREV_FIELD;
-                }
-            }
+            DEBUG(printf("[RJ] remove empty last record\n"));
+            free_record(rj, cr);
+            if(ret < 0)
+                break;
         }
     }
+    rj->rec = j->cqh_first != (void*)j ? j->cqh_first : 0;
     
-    if(prevtype == PREV_COMMENT)
-    {
-        DEBUG(printf("[RJ] remove empty last record\n"));
-        struct chain_record* cr = j->cqh_last;
-        CIRCLEQ_REMOVE(j, cr, chain);
-        free(cr);
-    }
-    
-    if(line)
-        free(line);
+    if(p.line)
+        free(p.line);
     fclose(fp);
-    return EXIT_SUCCESS;
+    return ret < 0 ? ret : EXIT_SUCCESS;
 }
 
-int rj_save(const char* file, struct recordjar* rj)
+int rj_open(const char* file, size_t budget, struct recordjar* rj)
 {
-    FILE* fp = fopen(file, "w");
+    FILE* fp = fopen(file, "r");
     if(!fp)
         return errno;
     
-    fprintf(fp, "%%%%encoding: US-ASCII\n");
+    rj_init(rj);
     
-    char* buf = 0;
-    struct jar* j = (struct jar*) rj->jar;
-    struct chain_record* r = j->cqh_first;
-    while(1)
+    struct jar* j = rj->jar;
+    struct cache* c = (struct cache*) malloc(sizeof(struct cache));
+    int ret = 0;
+    
+    memset(c, 0, sizeof(struct cache));
+    c->p.fp = fp;
+    c->spill.encoding = 1;
+    c->budget = budget;
+    TAILQ_INIT(&c->lru);
+    TAILQ_INIT(&c->dirty);
+    
+    // index only, records are parsed by touch
+    while(!c->p.eof)
     {
-        struct chain_field* f = r->rec.tqh_first;
-        while(f)
+        off_t offset = ftello(fp);
+        if((ret = parse_record(&c->p, 0, 0)) > 0)
         {
-            escape(&buf, f->value, 0); // overwrite
-            fprintf(fp, "%s: %s\n", f->field, buf);
-            f = f->chain.tqe_next;
+            struct chain_record* cr = new_record(rj);
+            CIRCLEQ_INSERT_TAIL(j, cr, chain);
+            cr->offset = offset;
+            cr->flags = 0;
+            ++rj->size;
         }
-        r = r->chain.cqe_next;
-        if(r == (void*)j)
+        else if(ret < 0)
             break;
-        else
-            fprintf(fp, "%%%%\n");
     }
+    rj->cache = c;
+    rj->rec = j->cqh_first != (void*)j ? j->cqh_first : 0;
     
-    if(buf)
-        free(buf);
-    fclose(fp);
-    return EXIT_SUCCESS;
+    return ret < 0 ? ret : EXIT_SUCCESS;
+}
+
+int rj_save(const char* file, struct recordjar* rj)
+{
+    struct journal* jl = (struct journal*) rj->journal;
+    
+    if(jl && !strcmp(file, jl->file))
+        return rj_checkpoint(rj);
+    
+    // lazy jars may still read from file
+    return save(file, rj->cache != 0, 1, rj);
+}
+
+int rj_save_parallel(const char* file, int threads, struct recordjar* rj)
+{
+    struct journal* jl = (struct journal*) rj->journal;
+    
+    if(threads <= 0)
+        threads = sysconf(_SC_NPROCESSORS_ONLN);
+    if(jl && !strcmp(file, jl->file))
+        return checkpoint(threads, rj);
+    
+    return save(file, rj->cache != 0, threads, rj);
 }
 
 void rj_free(struct recordjar* rj)
 {
     struct jar* j = (struct jar*) rj->jar;
-    while(j->cqh_first != (void*)j)
+    struct cache* c = (struct cache*) rj->cache;
+    
+    if(rj->index)
     {
-        struct chain_record* cr = j->cqh_first;
-        struct record* r = &cr->rec;
-        struct chain_field* cf = r->tqh_first;
-        while(cf)
-        {
-            free(cf->field);
-            free(cf->value);
-            TAILQ_REMOVE(r, cf, chain);
-            free(cf);
-            cf = r->tqh_first;
-        }
-        CIRCLEQ_REMOVE(j, cr, chain);
-        free(cr);
+        memset(rj, 0, sizeof(struct recordjar));
+        return;
     }
+    while(j->cqh_first != (void*)j)
+        free_record(rj, j->cqh_first);
     free(j);
+    if(rj->journal)
+        journal_close(rj);
+    if(c)
+    {
+        if(c->p.line)
+            free(c->p.line);
+        fclose(c->p.fp);
+        if(c->spill.fp)
+            fclose(c->spill.fp);
+        free(c->spill.line);
+        free(c->buf);
+        free(c);
+    }
     memset(rj, 0, sizeof(struct recordjar));
 }
 
@@ -295,6 +201,10 @@ const char* rj_strerror(int error)
     {
     case RJ_ERROR_ENCODING_INVALID:     return "encoding invalid";
     case RJ_ERROR_ENCODING_UNSUPPORTED: return "encoding unsupported";
+    case RJ_ERROR_JOURNAL_INVALID:      return "journal invalid";
+    case RJ_EOF:                        return "end of file";
+    case RJ_ERROR_SCHEMA_MISMATCH:      return "schema mismatch";
+    case RJ_ERROR_SHARD_MISMATCH:       return "shard mismatch";
     default:                            return strerror(error);
     }
 }
@@ -302,30 +212,155 @@ const char* rj_strerror(int error)
 void rj_mapfold(rj_mapfold_func* func, void* state, struct recordjar* rj)
 {
     struct jar* j = (struct jar*) rj->jar;
-    struct chain_record* r = j->cqh_first;
-    int rec_first = 1;
     void* tmp = rj->rec;
     
-    while(1)
+    if(j->cqh_first != (void*)j)
+        mapfold(j->cqh_first, -1, func, state, rj);
+    rj->rec = tmp;
+}
+
+struct mapfold_range
+{
+    pthread_t thread;
+    struct chain_record* first;
+    int count;
+    rj_mapfold_func* func;
+    void* state;
+    struct recordjar rj;
+};
+
+void* mapfold_thread(void* arg)
+{
+    struct mapfold_range* range = (struct mapfold_range*) arg;
+    mapfold(range->first, range->count, range->func, range->state, &range->rj);
+    return 0;
+}
+
+void rj_mapfold_parallel(rj_mapfold_func* func, rj_mapfold_init_func* init,
+    rj_mapfold_reduce_func* reduce, void* state, int threads, struct recordjar* rj)
+{
+    struct jar* j = (struct jar*) rj->jar;
+    struct chain_record* r;
+    int count = 0, i, k;
+    
+    for(r = j->cqh_first; r != (void*)j; r = r->chain.cqe_next)
+        ++count;
+    if(!count)
+        return;
+    
+    if(threads <= 0)
+        threads = sysconf(_SC_NPROCESSORS_ONLN);
+    if(rj->cache) // touch is not thread safe
+        threads = 1;
+    if(threads > count)
+        threads = count;
+    if(threads <= 1)
     {
-        int fld_first = 1;
-        int rec_last = r->chain.cqe_next == (void*)j;
-        struct chain_field* f = r->rec.tqh_first;
-        rj->rec = r;
-        while(f)
+        void* part = init(state);
+        rj_mapfold(func, part, rj);
+        reduce(state, part);
+        return;
+    }
+    
+    struct mapfold_range* ranges = (struct mapfold_range*) malloc(threads*sizeof(struct mapfold_range));
+    r = j->cqh_first;
+    for(i = 0; i < threads; ++i)
+    {
+        struct mapfold_range* range = &ranges[i];
+        range->first = r;
+        range->count = count/threads + (i < count%threads);
+        range->func = func;
+        range->state = init(state);
+        range->rj = *rj;
+        range->rj.field = 0;
+        for(k = 0; k < range->count; ++k)
+            r = r->chain.cqe_next;
+        
+        if(pthread_create(&range->thread, 0, mapfold_thread, range))
         {
-            int fld_last = f->chain.tqe_next == 0;
-            int info = rec_first | rec_last<<1 | fld_first<<2 | fld_last<<3;
-            func(info, &f->field, &f->value, state, rj);
-            f = f->chain.tqe_next;
-            fld_first = 0;
+            DEBUG(printf("[RJ] mapfold thread failed, running inline\n"));
+            mapfold_thread(range);
+            range->count = 0;
         }
-        r = r->chain.cqe_next;
-        rec_first = 0;
-        if(r == (void*)j)
-            break;
     }
+    
+    // reduce in record order
+    for(i = 0; i < threads; ++i)
+    {
+        if(ranges[i].count)
+            pthread_join(ranges[i].thread, 0);
+        reduce(state, ranges[i].state);
+    }
+    free(ranges);
+}
+
+int rj_del_records_where(const char* key, const char* keyval,
+    rj_where_func* func, void* state, struct recordjar* rj)
+{
+    struct jar* j = (struct jar*) rj->jar;
+    struct chain_record *r = j->cqh_first, *next;
+    void* tmp = rj->rec;
+    int count = 0, ret;
+    
+    if(rj->index)
+        return -EROFS;
+    
+    while(r != (void*)j)
+    {
+        next = r->chain.cqe_next;
+        if(match_record(rj, r, key, keyval))
+        {
+            rj->rec = r;
+            rj->field = 0;
+            if(!func || func(state, rj))
+            {
+                if(r == tmp)
+                    tmp = 0;
+                journal_log(rj, 'R', r, 0, 0, 0);
+                free_record(rj, r);
+                --rj->size;
+                ++count;
+            }
+        }
+        r = next;
+    }
+    
+    if(!tmp)
+        tmp = j->cqh_first != (void*)j ? j->cqh_first : 0;
     rj->rec = tmp;
+    rj->field = 0;
+    if((ret = journal_error(rj)))
+        return -ret;
+    return count;
+}
+
+int rj_update_where(const char* key, const char* keyval,
+    rj_where_func* func, void* state, struct recordjar* rj)
+{
+    struct jar* j = (struct jar*) rj->jar;
+    struct chain_record *r = j->cqh_first, *next;
+    int count = 0;
+    
+    if(rj->index)
+        return -EROFS;
+    
+    while(r != (void*)j)
+    {
+        next = r->chain.cqe_next;
+        if(match_record(rj, r, key, keyval))
+        {
+            rj->rec = r;
+            rj->field = 0;
+            if(func(state, rj))
+                ++count;
+        }
+        r = next;
+    }
+    
+    // func may have removed the memorized record
+    rj->rec = j->cqh_first != (void*)j ? j->cqh_first : 0;
+    rj->field = 0;
+    return count;
 }
 
 void rj_next(char** field, char** value, struct recordjar* rj)
@@ -334,7 +369,10 @@ void rj_next(char** field, char** value, struct recordjar* rj)
     struct chain_field* cf = rj->field;
     
     if(!cf)
+    {
+        touch(rj, cr);
         cf = rj->field = cr->rec.tqh_first;
+    }
     else
         cf = rj->field = cf->chain.tqe_next;
     
@@ -350,39 +388,188 @@ void rj_next(char** field, char** value, struct recordjar* rj)
     }
 }
 
-#define MET_GET(Name, Mode) \
-    char* rj_##Name(const char* key, const char* keyval, \
-        const char* field, const char* def, struct recordjar* rj) \
-    { \
-        return mod(MOD_##Mode|MOD_GET, key, keyval, field, def, 0, rj); \
-    }
+// record handles stay valid until their record is deleted
 
-MET_GET(get, THIS)
-MET_GET(get_next, NEXT)
-MET_GET(get_prev, PREV)
-MET_GET(get_only, ONLY)
+rj_record_t rj_first(struct recordjar* rj)
+{
+    struct jar* j = (struct jar*) rj->jar;
+    return j->cqh_first != (void*)j ? j->cqh_first : 0;
+}
 
-#define MET_ADD(Name, Mode) \
-    int rj_##Name(const char* key, const char* keyval, \
-        const char* field, const char* value, struct recordjar* rj) \
-    { \
-        return !mod(MOD_##Mode|MOD_ADD, key, keyval, field, value, 0, rj); \
-    }
+rj_record_t rj_last(struct recordjar* rj)
+{
+    struct jar* j = (struct jar*) rj->jar;
+    return j->cqh_last != (void*)j ? j->cqh_last : 0;
+}
 
-MET_ADD(add, THIS)
-MET_ADD(add_next, NEXT)
-MET_ADD(add_prev, PREV)
-MET_ADD(add_only, ONLY)
+rj_record_t rj_record_next(rj_record_t rec, struct recordjar* rj)
+{
+    struct chain_record* r = ((struct chain_record*) rec)->chain.cqe_next;
+    return r != rj->jar ? r : 0;
+}
 
-#define MET_SET(Name, Mode) \
-    int rj_##Name(const char* key, const char* keyval, \
-        const char* field, const char* value, struct recordjar* rj) \
-    { \
-        return !mod(MOD_##Mode|MOD_SET, key, keyval, field, value, 0, rj); \
-    }
+rj_record_t rj_record_prev(rj_record_t rec, struct recordjar* rj)
+{
+    struct chain_record* r = ((struct chain_record*) rec)->chain.cqe_prev;
+    return r != rj->jar ? r : 0;
+}
 
-MET_SET(set, THIS)
-MET_SET(set_next, NEXT)
+rj_record_t rj_find(const char* key, const char* keyval, rj_record_t after, struct recordjar* rj)
+{
+    return rj_find_len(key, key ? strlen(key) : 0,
+        keyval, keyval ? strlen(keyval) : 0, after, rj);
+}
+
+rj_record_t rj_find_len(const char* key, size_t klen, const char* keyval, size_t vlen,
+    rj_record_t after, struct recordjar* rj)
+{
+    rj_record_t r = after ? rj_record_next(after, rj) : rj_first(rj);
+    
+    while(r && !match_record_len(rj, r, key, klen, keyval, vlen))
+        r = rj_record_next(r, rj);
+    return r;
+}
+
+struct chain_field* record_field(rj_record_t rec, const char* field, struct recordjar* rj)
+{
+    struct chain_record* r = (struct chain_record*) rec;
+    
+    rj->rec = r;
+    rj->field = 0;
+    touch(rj, r);
+    return field ? find_field(&r->rec, field) : 0;
+}
+
+char* rj_record_get(rj_record_t rec, const char* field, const char* def, struct recordjar* rj)
+{
+    struct chain_field* f = record_field(rec, field, rj);
+    return f ? f->value : (char*) def;
+}
+
+char* rj_record_get_len(rj_record_t rec, const char* field, size_t len,
+    const char* def, struct recordjar* rj)
+{
+    struct chain_field* f;
+    
+    record_field(rec, 0, rj);
+    f = find_field_len(&((struct chain_record*) rec)->rec, field, len);
+    return f ? f->value : (char*) def;
+}
+
+int rj_record_set(rj_record_t rec, const char* field, const char* value, struct recordjar* rj)
+{
+    struct chain_field* f;
+    if(rj->index)
+        return EROFS;
+    f = record_field(rec, field, rj);
+    return f ? mod_result(mod_apply(MOD_SET, rec, f, field, value, 0, rj), rj) : 1;
+}
+
+int rj_record_app(rj_record_t rec, const char* field, const char* value,
+    const char* delim, struct recordjar* rj)
+{
+    struct chain_field* f;
+    const char* d = delim ? delim : "";
+    if(rj->index)
+        return EROFS;
+    f = record_field(rec, field, rj);
+    return f ? mod_result(mod_apply(MOD_APP, rec, f, field, value, d, rj), rj) : 1;
+}
+
+int rj_record_add(rj_record_t rec, const char* field, const char* value, struct recordjar* rj)
+{
+    if(rj->index)
+        return EROFS;
+    record_field(rec, 0, rj);
+    return mod_result(mod_apply(MOD_ADD, rec, 0, field, value, 0, rj), rj);
+}
+
+int rj_record_del_field(rj_record_t rec, const char* field, struct recordjar* rj)
+{
+    struct chain_field* f;
+    if(rj->index)
+        return EROFS;
+    if(!(f = record_field(rec, field, rj)))
+        return 1;
+    mod_apply(MOD_DEL, rec, f, field, 0, 0, rj);
+    return journal_error(rj);
+}
+
+int rj_record_del(rj_record_t rec, struct recordjar* rj)
+{
+    if(rj->index)
+        return EROFS;
+    record_field(rec, 0, rj);
+    mod_apply(MOD_DEL_REC, rec, 0, 0, 0, 0, rj);
+    return journal_error(rj);
+}
+
+// field handles stay valid until their field is deleted or the record unloaded
+
+rj_field_t rj_record_fields(rj_record_t rec, struct recordjar* rj)
+{
+    touch(rj, rec);
+    return ((struct chain_record*) rec)->rec.tqh_first;
+}
+
+rj_field_t rj_field_next(rj_field_t field)
+{
+    return ((struct chain_field*) field)->chain.tqe_next;
+}
+
+const char* rj_field_name(rj_field_t field)
+{
+    return ((struct chain_field*) field)->field;
+}
+
+const char* rj_field_value(rj_field_t field)
+{
+    return ((struct chain_field*) field)->value;
+}
+
+// failures of the method or of journaling its modification
+
+int mod_result(const char* ret, struct recordjar* rj)
+{
+    int error = journal_error(rj);
+    return error ? error : !ret;
+}
+
+#define MET_GET(Name, Mode) \
+    char* rj_##Name(const char* key, const char* keyval, \
+        const char* field, const char* def, struct recordjar* rj) \
+    { \
+        return mod(MOD_##Mode|MOD_GET, key, keyval, field, def, 0, rj); \
+    }
+
+MET_GET(get, THIS)
+MET_GET(get_next, NEXT)
+MET_GET(get_prev, PREV)
+MET_GET(get_only, ONLY)
+
+#define MET_ADD(Name, Mode) \
+    int rj_##Name(const char* key, const char* keyval, \
+        const char* field, const char* value, struct recordjar* rj) \
+    { \
+        return rj->index ? EROFS : \
+            mod_result(mod(MOD_##Mode|MOD_ADD, key, keyval, field, value, 0, rj), rj); \
+    }
+
+MET_ADD(add, THIS)
+MET_ADD(add_next, NEXT)
+MET_ADD(add_prev, PREV)
+MET_ADD(add_only, ONLY)
+
+#define MET_SET(Name, Mode) \
+    int rj_##Name(const char* key, const char* keyval, \
+        const char* field, const char* value, struct recordjar* rj) \
+    { \
+        return rj->index ? EROFS : \
+            mod_result(mod(MOD_##Mode|MOD_SET, key, keyval, field, value, 0, rj), rj); \
+    }
+
+MET_SET(set, THIS)
+MET_SET(set_next, NEXT)
 MET_SET(set_prev, PREV)
 MET_SET(set_only, ONLY)
 
@@ -391,7 +578,8 @@ MET_SET(set_only, ONLY)
         const char* value, const char* delim, struct recordjar* rj) \
     { \
         const char* d = delim ? delim : ""; \
-        return !mod(MOD_##Mode|MOD_APP, key, keyval, field, value, d, rj); \
+        return rj->index ? EROFS : \
+            mod_result(mod(MOD_##Mode|MOD_APP, key, keyval, field, value, d, rj), rj); \
     }
 
 MET_APP(app, THIS)
@@ -403,7 +591,8 @@ MET_APP(app_only, ONLY)
     int rj_##Name(const char* key, const char* keyval, \
         const char* field, struct recordjar* rj) \
     { \
-        return !mod(MOD_##Mode|MOD_DEL, key, keyval, field, 0, 0, rj); \
+        return rj->index ? EROFS : \
+            mod_result(mod(MOD_##Mode|MOD_DEL, key, keyval, field, 0, 0, rj), rj); \
     }
 
 MET_DEL_FIELD(del_field, THIS)
@@ -414,7 +603,8 @@ MET_DEL_FIELD(del_field_only, ONLY)
 #define MET_DEL_RECORD(Name, Mode) \
     int rj_##Name(const char* key, const char* keyval, struct recordjar* rj) \
     { \
-        return !mod(MOD_##Mode|MOD_DEL_REC, key, keyval, 0, 0, 0, rj); \
+        return rj->index ? EROFS : \
+            mod_result(mod(MOD_##Mode|MOD_DEL_REC, key, keyval, 0, 0, 0, rj), rj); \
     }
 
 MET_DEL_RECORD(del_record, THIS)
@@ -444,35 +634,22 @@ int trim(char** str)
     return 0;
 }
 
-// mode == 0 - append
-// mode != 0 - overwrite
+// mode == 0 - overwrite
+// mode != 0 - append
 
-char* escape_alloc(char** dest, int elen, int mode)
+char* escape_alloc(char** dest, size_t* len, size_t* size, size_t elen, int mode)
 {
-    static int size;
-    if(!*dest)
+    size_t need = (mode ? *len : 0) + elen + 1;
+    if(!*dest || need > *size)
     {
-        size = elen+1;
-        *dest = (char*) malloc(size*sizeof(char));
-        return *dest;
-    }
-    else
-    {
-        int len = strlen(*dest);
-        if(mode)
-        {
-            size = len+elen+1;
-            *dest = (char*) realloc(*dest, size*sizeof(char));
-            return *dest+len;
-        }
-        else if(elen+1 > size)
-        {
-            size = elen+1;
-            *dest = (char*) realloc(*dest, size*sizeof(char));
-            return *dest;
-        }
-        return *dest;
+        // grow geometrically so repeated appends stay amortized O(1)
+        size_t grow = *dest ? 2 * *size : 0;
+        *size = need > grow ? need : grow;
+        *dest = (char*) realloc(*dest, *size*sizeof(char));
     }
+    char* dptr = mode ? *dest + *len : *dest;
+    *len = need - 1;
+    return dptr;
 }
 
 int escape_len(const char* str)
@@ -491,7 +668,7 @@ int escape_len(const char* str)
                 ++count;
         }
     }
-    if(str[-1] == ' ') // continuation
+    if(count && str[-1] == ' ') // continuation
         ++count;
     return count;
 }
@@ -542,23 +719,23 @@ char* escape_copy(char* dest, const char* src)
 // delim == 0: dest = src
 // delim != 0: dest = dest delim src
 
-int escape(char** dest, const char* src, const char* delim)
+int escape(char** dest, size_t* dlen, size_t* size, const char* src, const char* delim)
 {
     int len;
     char* dptr;
     if(delim)
     {
         len = escape_len(src) + escape_len(delim);
-        dptr = escape_alloc(dest, len, 1);
+        dptr = escape_alloc(dest, dlen, size, len, 1);
         dptr = escape_copy(dptr, delim);
     }
     else
     {
         len = escape_len(src);
-        dptr = escape_alloc(dest, len, 0);
+        dptr = escape_alloc(dest, dlen, size, len, 0);
     }
     dptr = escape_copy(dptr, src);
-    if(dptr[-1] == ' ') // continuation
+    if(dptr > *dest && dptr[-1] == ' ') // continuation
     {
         dptr[0] = '\\';
         dptr[1] = '\0';
@@ -589,36 +766,622 @@ char* escape_rev_copy(char* dest, const char* src)
     return dest;
 }
 
-// delim == 0: dest = src
-// delim != 0: dest = dest delim src
+// delim == 0: dest = src
+// delim != 0: dest = dest delim src
+
+int escape_rev(char** dest, size_t* dlen, size_t* size, const char* src, const char* delim)
+{
+    int len;
+    char* dptr;
+    if(delim)
+    {
+        len = escape_len_rev(src) + escape_len_rev(delim);
+        dptr = escape_alloc(dest, dlen, size, len, 1);
+        dptr = escape_rev_copy(dptr, delim);
+    }
+    else
+    {
+        len = escape_len_rev(src);
+        dptr = escape_alloc(dest, dlen, size, len, 0);
+    }
+    escape_rev_copy(dptr, src);
+    return len;
+}
+
+// r == 0 - only skip the record or hand the fields to b
+// returns the number of fields of the record, p->eof is set at end of file
+
+int parse_record(struct parser* p, struct record* r, struct bind* b)
+{
+    int count, prevtype = 0, fields = 0;
+    struct chain_field* f = 0;
+    
+    while((count = getline(&p->line, &p->size, p->fp)) != -1)
+    {
+        char* line = p->line;
+        
+        if(!p->encoding)
+        {
+            p->encoding = 1;
+            if(count >= 2 && line[0] == '%' && line[1] == '%')
+            {
+                DEBUG(printf("[RJ] check encoding\n"));
+                char* enc = line+2;
+                char* field = strtok(enc, ":");
+                char* value = strtok(0, ":");
+                if(field[0] == ':' || !value)
+                    DEBUG(printf("  no encoding signature\n"));
+                else
+                {
+                    trim(&field);
+                    if(!strcmp(field, "encoding"))
+                    {
+                        if(trim(&value))
+                        {
+                            if(!strcmp(value, "US-ASCII"))
+                            {
+                                DEBUG(printf("  US-ASCII\n"));
+                                continue;
+                            }
+                            else
+                            {
+                                DEBUG(printf("  no supported encoding signature\n"));
+                                return RJ_ERROR_ENCODING_UNSUPPORTED;
+                            }
+                        }
+                        else
+                        {
+                            DEBUG(printf("  invalid encoding signature\n"));
+                            return RJ_ERROR_ENCODING_INVALID;
+                        }
+                    }
+                    else
+                        DEBUG(printf("  no encoding signature\n"));
+                }
+            }
+        }
+        
+        if(count == 1 && line[0] == '\n')
+            DEBUG(printf("[RJ] ignored newline\n"));
+        else if(count >= 1 && (line[0] == ' ' || line[0] == '\t'))
+        {
+            DEBUG(printf("[RJ] fold line\n"));
+            if(prevtype == PREV_FIELD)
+            {
+                if(!r && !b)
+                    continue;
+                char* value = line;
+                int newlen = trim(&value);
+                if(newlen && value[newlen-1] == '\\')
+                {
+                    DEBUG(printf("  continued\n"));
+                    value[newlen-1] = 0;
+                    --newlen;
+                }
+                escape_rev(&f->value, &f->len, &f->size, value, ""); // append
+            }
+            else
+                DEBUG(printf("  error beginning fold line\n"));
+        }
+        else if(count >= 2 && line[0] == '%' && line[1] == '%')
+        {
+            DEBUG(printf("[RJ] comment\n"));
+            if(prevtype == PREV_FIELD)
+            {
+                DEBUG(printf("  new record\n"));
+                if(b && f)
+                    bind_field(b, f);
+                return fields;
+            }
+            prevtype = PREV_COMMENT;
+        }
+        else
+        {
+            DEBUG(printf("[RJ] field\n"));
+            char* value;
+            char* field = strtok_r(line, ":", &value);
+            
+            if(field[0] == ':' || !value)
+                DEBUG(printf("  error no field name\n"));
+            else
+            {
+                trim(&field);
+                int valuelen = trim(&value);
+                if(!valuelen)
+                    DEBUG(printf("  error no value\n"));
+                else
+                {
+                    ++fields;
+                    prevtype = PREV_FIELD;
+                    if(!r && !b)
+                        continue;
+                    
+                    if(value[valuelen-1] == '\\')
+                    {
+                        DEBUG(printf("  continued\n"));
+                        value[valuelen-1] = 0;
+                        --valuelen;
+                    }
+                    
+                    if(b)
+                    {
+                        if(f)
+                            bind_field(b, f);
+                        f = bind_scratch(b, field);
+                    }
+                    else
+                        f = new_field(r, field, 0);
+                    escape_rev(&f->value, &f->len, &f->size, value, 0); // overwrite
+                }
+            }
+        }
+    }
+    
+    if(b && f)
+        bind_field(b, f);
+    p->eof = 1;
+    return fields;
+}
+
+struct chain_record* new_record(struct recordjar* rj)
+{
+    struct chain_record* cr = (struct chain_record*) malloc(sizeof(struct chain_record));
+    TAILQ_INIT(&cr->rec);
+    cr->offset = 0;
+    cr->bytes = 0;
+    cr->id = 0; // numbered by its N entry in journaled jars
+    cr->flags = RECORD_LOADED;
+    if(rj->cache)
+    {
+        struct cache* c = (struct cache*) rj->cache;
+        cr->flags |= RECORD_DIRTY;
+        cr->bytes = sizeof(struct chain_record);
+        TAILQ_INSERT_HEAD(&c->dirty, cr, lru);
+        c->pinned += cr->bytes;
+    }
+    return cr;
+}
+
+struct chain_field* new_field(struct record* r, const char* field, const char* value)
+{
+    struct chain_field* f = (struct chain_field*) malloc(sizeof(struct chain_field));
+    TAILQ_INSERT_TAIL(r, f, chain);
+    f->field = (char*) malloc((strlen(field)+1)*sizeof(char));
+    strcpy(f->field, field);
+    f->value = 0;
+    f->len = 0;
+    f->size = 0;
+    if(value)
+    {
+        size_t len = strlen(value);
+        memcpy(escape_alloc(&f->value, &f->len, &f->size, len, 0), value, len+1);
+    }
+    return f;
+}
+
+struct chain_field* find_field(struct record* r, const char* field)
+{
+    return find_field_len(r, field, strlen(field));
+}
+
+struct chain_field* find_field_len(struct record* r, const char* field, size_t len)
+{
+    struct chain_field* f = r->tqh_first;
+    while(f && (strncmp(f->field, field, len) || f->field[len]))
+        f = f->chain.tqe_next;
+    return f;
+}
+
+void free_field(struct record* r, struct chain_field* f)
+{
+    free(f->field);
+    free(f->value);
+    TAILQ_REMOVE(r, f, chain);
+    free(f);
+}
+
+void free_fields(struct record* r)
+{
+    while(r->tqh_first)
+        free_field(r, r->tqh_first);
+}
+
+void unload(struct cache* c, struct chain_record* r)
+{
+    DEBUG(printf("[RJ] unload record at %li\n", (long) r->offset));
+    free_fields(&r->rec);
+    TAILQ_REMOVE(&c->lru, r, lru);
+    c->used -= r->bytes;
+    r->flags &= ~RECORD_LOADED;
+}
+
+size_t record_bytes(struct chain_record* r)
+{
+    struct chain_field* f;
+    size_t bytes = sizeof(struct chain_record);
+    for(f = r->rec.tqh_first; f; f = f->chain.tqe_next)
+        bytes += sizeof(struct chain_field) + strlen(f->field) + 1 + f->size;
+    return bytes;
+}
+
+// writes a dirty record to the spill file and unloads it, it is
+// loaded from there as a clean record
+
+int spill(struct cache* c, struct chain_record* r)
+{
+    off_t offset;
+    
+    if(!c->spill.fp && !(c->spill.fp = tmpfile()))
+        return errno;
+    if(fseeko(c->spill.fp, 0, SEEK_END) || (offset = ftello(c->spill.fp)) == -1)
+        return errno;
+    write_record(c->spill.fp, r, &c->buf, &c->len, &c->size);
+    fprintf(c->spill.fp, "%%%%\n");
+    if(ferror(c->spill.fp))
+        return errno ? errno : EIO;
+    
+    DEBUG(printf("[RJ] spill record to %li\n", (long) offset));
+    free_fields(&r->rec);
+    TAILQ_REMOVE(&c->dirty, r, lru);
+    c->pinned -= r->bytes;
+    r->offset = offset;
+    r->flags = RECORD_SPILLED;
+    return EXIT_SUCCESS;
+}
+
+// keeps the jar within its budget except for the given record
+
+void shrink(struct recordjar* rj, struct chain_record* keep)
+{
+    struct cache* c = (struct cache*) rj->cache;
+    struct chain_record* victim;
+    
+    while(c->used + c->pinned > c->budget &&
+        (victim = TAILQ_LAST(&c->lru, lru)) && victim != keep)
+        unload(c, victim);
+    while(c->used + c->pinned > c->budget &&
+        (victim = TAILQ_LAST(&c->dirty, lru)) && victim != keep)
+        if(spill(c, victim))
+            break;
+}
+
+// makes the fields of a record resident, other records are
+// unloaded or spilled least recently used first to stay within the budget
+
+void touch(struct recordjar* rj, struct chain_record* r)
+{
+    struct cache* c = (struct cache*) rj->cache;
+    struct parser* p;
+    
+    if(!c)
+        return;
+    
+    if(r->flags & (RECORD_LOADED|RECORD_DIRTY))
+    {
+        struct lru* l = r->flags & RECORD_DIRTY ? &c->dirty : &c->lru;
+        TAILQ_REMOVE(l, r, lru);
+        TAILQ_INSERT_HEAD(l, r, lru);
+        return;
+    }
+    
+    p = r->flags & RECORD_SPILLED ? &c->spill : &c->p;
+    DEBUG(printf("[RJ] load record at %li\n", (long) r->offset));
+    fseeko(p->fp, r->offset, SEEK_SET);
+    p->eof = 0;
+    parse_record(p, &r->rec, 0);
+    
+    r->bytes = record_bytes(r);
+    r->flags |= RECORD_LOADED;
+    TAILQ_INSERT_HEAD(&c->lru, r, lru);
+    c->used += r->bytes;
+    
+    shrink(rj, r);
+}
+
+// modified records are pinned until they are spilled
+
+void dirty(struct recordjar* rj, struct chain_record* r)
+{
+    struct cache* c = (struct cache*) rj->cache;
+    
+    if(!c)
+        return;
+    
+    if(r->flags & RECORD_DIRTY)
+    {
+        // records grow while dirty
+        c->pinned -= r->bytes;
+        r->bytes = record_bytes(r);
+    }
+    else
+    {
+        TAILQ_REMOVE(&c->lru, r, lru);
+        c->used -= r->bytes;
+        TAILQ_INSERT_HEAD(&c->dirty, r, lru);
+        r->flags |= RECORD_DIRTY;
+    }
+    c->pinned += r->bytes;
+    shrink(rj, r);
+}
+
+int match_record(struct recordjar* rj, struct chain_record* r,
+    const char* key, const char* keyval)
+{
+    return match_record_len(rj, r, key, key ? strlen(key) : 0,
+        keyval, keyval ? strlen(keyval) : 0);
+}
+
+int match_record_len(struct recordjar* rj, struct chain_record* r,
+    const char* key, size_t klen, const char* keyval, size_t vlen)
+{
+    touch(rj, r);
+    
+    struct chain_field* f = r->rec.tqh_first;
+    while(f)
+    {
+        if((!key || (!strncmp(f->field, key, klen) && !f->field[klen])) &&
+            (!keyval || (!strncmp(f->value, keyval, vlen) && !f->value[vlen])))
+            return 1;
+        f = f->chain.tqe_next;
+    }
+    return 0;
+}
+
+void free_record(struct recordjar* rj, struct chain_record* cr)
+{
+    struct cache* c = (struct cache*) rj->cache;
+    
+    if(rj->index) // records of static jars are not allocated
+        return;
+    if(c && (cr->flags & RECORD_DIRTY))
+    {
+        TAILQ_REMOVE(&c->dirty, cr, lru);
+        c->pinned -= cr->bytes;
+    }
+    else if(c && (cr->flags & RECORD_LOADED))
+        unload(c, cr);
+    free_fields(&cr->rec);
+    CIRCLEQ_REMOVE((struct jar*) rj->jar, cr, chain);
+    free(cr);
+}
+
+void write_record(FILE* fp, struct chain_record* r, char** buf, size_t* len, size_t* size)
+{
+    struct chain_field* f = r->rec.tqh_first;
+    while(f)
+    {
+        escape(buf, len, size, f->value, 0); // overwrite
+        fprintf(fp, "%s: %s\n", f->field, *buf);
+        f = f->chain.tqe_next;
+    }
+}
+
+struct save_chunk
+{
+    pthread_t thread;
+    struct chain_record* first;
+    int count, error;
+    char* buf;
+    size_t bytes;
+};
+
+void* save_thread(void* arg)
+{
+    struct save_chunk* c = (struct save_chunk*) arg;
+    struct chain_record* r = c->first;
+    char* buf = 0;
+    size_t len = 0, size = 0;
+    int i;
+    
+    FILE* fp = open_memstream(&c->buf, &c->bytes);
+    if(!fp)
+    {
+        c->error = errno;
+        return 0;
+    }
+    for(i = 0; i < c->count; ++i, r = r->chain.cqe_next)
+    {
+        if(i)
+            fprintf(fp, "%%%%\n");
+        write_record(fp, r, &buf, &len, &size);
+    }
+    if(buf)
+        free(buf);
+    if(fclose(fp))
+        c->error = errno;
+    return 0;
+}
+
+// records are formatted in rounds of one chunk per thread into
+// memory streams which are written in order between the rounds
+
+int save_parallel(FILE* fp, int threads, struct recordjar* rj)
+{
+    struct jar* j = (struct jar*) rj->jar;
+    struct chain_record* r = j->cqh_first;
+    struct save_chunk* chunks = (struct save_chunk*) malloc(threads*sizeof(struct save_chunk));
+    int ret = EXIT_SUCCESS, first = 1, i, n;
+    
+    if(!chunks)
+        return ENOMEM;
+    
+    while(r != (void*)j)
+    {
+        for(n = 0; n < threads && r != (void*)j; ++n)
+        {
+            struct save_chunk* c = &chunks[n];
+            memset(c, 0, sizeof(struct save_chunk));
+            c->first = r;
+            for(; c->count < SAVE_CHUNK && r != (void*)j; r = r->chain.cqe_next)
+                ++c->count;
+            
+            if(pthread_create(&c->thread, 0, save_thread, c))
+            {
+                DEBUG(printf("[RJ] save thread failed, running inline\n"));
+                save_thread(c);
+                c->count = 0;
+            }
+        }
+        
+        for(i = 0; i < n; ++i)
+        {
+            struct save_chunk* c = &chunks[i];
+            if(c->count)
+                pthread_join(c->thread, 0);
+            if(!ret && c->error)
+                ret = c->error;
+            if(!ret)
+            {
+                if(!first)
+                    fprintf(fp, "%%%%\n");
+                fwrite(c->buf, 1, c->bytes, fp);
+                first = 0;
+            }
+            free(c->buf);
+        }
+        if(!ret && ferror(fp))
+            ret = errno ? errno : EIO;
+        if(ret)
+            break;
+    }
+    
+    free(chunks);
+    return ret;
+}
+
+// makes a rename in the directory of file durable
+
+int sync_dir(const char* file)
+{
+    const char* slash = strrchr(file, '/');
+    char* dir = slash ? strndup(file, slash == file ? 1 : slash-file) : strdup(".");
+    int fd, ret = EXIT_SUCCESS;
+    
+    if((fd = open(dir, O_RDONLY)) == -1 || fsync(fd))
+        ret = errno;
+    if(fd != -1)
+        close(fd);
+    free(dir);
+    return ret;
+}
+
+// atomic != 0 - write to a temporary file which replaces file when synced
+// threads > 1 - format records in parallel
 
-int escape_rev(char** dest, const char* src, const char* delim)
+int save(const char* file, int atomic, int threads, struct recordjar* rj)
 {
-    int len;
-    char* dptr;
-    if(delim)
+    char* tmp = 0;
+    int ret = EXIT_SUCCESS;
+    
+    if(atomic && asprintf(&tmp, "%s.tmp", file) == -1)
+        return errno;
+    
+    FILE* fp = fopen(tmp ? tmp : file, "w");
+    if(!fp)
     {
-        len = escape_len_rev(src) + escape_len_rev(delim);
-        dptr = escape_alloc(dest, len, 1);
-        dptr = escape_rev_copy(dptr, delim);
+        ret = errno;
+        free(tmp);
+        return ret;
     }
+    
+    fprintf(fp, "%%%%encoding: US-ASCII\n");
+    
+    if(threads > 1 && !rj->cache) // touch is not thread safe
+        ret = save_parallel(fp, threads, rj);
     else
     {
-        len = escape_len_rev(src);
-        dptr = escape_alloc(dest, len, 0);
+        char* buf = 0;
+        size_t len = 0, size = 0;
+        struct jar* j = (struct jar*) rj->jar;
+        struct chain_record* r = j->cqh_first;
+        while(r != (void*)j)
+        {
+            touch(rj, r);
+            write_record(fp, r, &buf, &len, &size);
+            r = r->chain.cqe_next;
+            if(r != (void*)j)
+                fprintf(fp, "%%%%\n");
+        }
+        if(buf)
+            free(buf);
+    }
+    
+    if(!ret && tmp && (fflush(fp) || fsync(fileno(fp))))
+        ret = errno;
+    if(fclose(fp) && !ret)
+        ret = errno;
+    
+    if(tmp)
+    {
+        if(!ret && rename(tmp, file))
+            ret = errno;
+        if(!ret)
+            ret = sync_dir(file);
+        free(tmp);
+    }
+    return ret;
+}
+
+// count < 0 - until end of jar
+
+void mapfold(struct chain_record* r, int count, rj_mapfold_func* func,
+    void* state, struct recordjar* rj)
+{
+    struct jar* j = (struct jar*) rj->jar;
+    int rec_first = r == j->cqh_first;
+    
+    while(count--)
+    {
+        int fld_first = 1;
+        int rec_last = r->chain.cqe_next == (void*)j;
+        touch(rj, r);
+        struct chain_field* f = r->rec.tqh_first;
+        rj->rec = r;
+        while(f)
+        {
+            int fld_last = f->chain.tqe_next == 0;
+            int info = rec_first | rec_last<<1 | fld_first<<2 | fld_last<<3;
+            char* value = f->value;
+            if(rj->index) // read only
+            {
+                char* field = f->field;
+                func(info, &field, &value, state, rj);
+                f = f->chain.tqe_next;
+                fld_first = 0;
+                continue;
+            }
+            size_t len = f->len;
+            func(info, &f->field, &f->value, state, rj);
+            // func may have replaced or shortened the value
+            f->len = strlen(f->value);
+            if(f->value != value)
+                f->size = f->len+1;
+            if(f->value != value || f->len != len)
+                dirty(rj, r);
+            f = f->chain.tqe_next;
+            fld_first = 0;
+        }
+        r = r->chain.cqe_next;
+        rec_first = 0;
+        if(r == (void*)j)
+            break;
     }
-    escape_rev_copy(dptr, src);
-    return len;
 }
 
 char* mod(int mode, const char* key, const char* keyval,
     const char* field, const char* elem1, const char* elem2, struct recordjar* rj)
 {
-    int found = 0;
+    int found = 0, stop = 0;
     struct jar* j = (struct jar*) rj->jar;
     struct chain_record* r = (struct chain_record*) rj->rec;
     struct chain_field *f = 0, *modf;
     
+    // static jars are read only
+    if(rj->index && !(mode & MOD_GET))
+        return 0;
+    if(rj->index && key && keyval)
+        return mod_static(mode, key, keyval, field, elem1, rj);
+    
     if(!r)
         goto notfound;
     
@@ -637,7 +1400,7 @@ char* mod(int mode, const char* key, const char* keyval,
                     r = j->cqh_last;
                 break;
             case MOD_ONLY:
-                if(f)
+                if(stop)
                     goto notfound;
                 break;
         }
@@ -646,6 +1409,7 @@ char* mod(int mode, const char* key, const char* keyval,
         if(mode & MOD_THIS)
             mode = (mode & ~MOD_THIS) | MOD_NEXT;
         
+        touch(rj, r);
         f = r->rec.tqh_first;
         while(f)
         {
@@ -667,7 +1431,7 @@ char* mod(int mode, const char* key, const char* keyval,
                 goto found;
             f = f->chain.tqe_next;
         }
-        f = r->rec.tqh_first; // stop of *_only
+        stop = 1; // stop of *_only, records may be empty
         found = 0;
     }
     
@@ -678,16 +1442,12 @@ notfound:
             return (char*) elem1;
         case MOD_ADD:
             // add new record
-            r = (struct chain_record*) malloc(sizeof(struct chain_record));
+            r = new_record(rj);
             CIRCLEQ_INSERT_HEAD(j, r, chain);
-            TAILQ_INIT(&r->rec);
+            ++rj->size;
             // add key
-            f = (struct chain_field*) malloc(sizeof(struct chain_field));
-            TAILQ_INSERT_TAIL(&r->rec, f, chain);
-            f->field = (char*) malloc((strlen(key)+1)*sizeof(char));
-            strcpy(f->field, key);
-            f->value = (char*) malloc((strlen(keyval)+1)*sizeof(char));
-            strcpy(f->value, keyval);
+            f = new_field(&r->rec, key, keyval);
+            journal_log(rj, 'N', r, key, keyval, 0);
             // add new elem
             goto found;
         default:
@@ -697,50 +1457,119 @@ notfound:
 found:
     rj->rec = r;
     rj->field = 0;
+    elem1 = mod_apply(mode, r, modf, field, elem1, elem2, rj);
+    return mode & (MOD_DEL|MOD_DEL_REC) ? (char*) key : (char*) elem1;
+}
+
+// visits the records containing key/keyval in the order mod would,
+// but only those listed by the index of the static jar
+
+char* mod_static(int mode, const char* key, const char* keyval,
+    const char* field, const char* def, struct recordjar* rj)
+{
+    const struct rj_static* s = (const struct rj_static*) rj->index;
+    const struct static_entry* e = static_find(s, key, keyval);
+    struct chain_record* r = (struct chain_record*) rj->rec;
+    struct chain_field* f;
+    const unsigned long* refs;
+    unsigned long id, k, n, start, i;
+    
+    if(!e || !r)
+        return (char*) def;
+    
+    refs = &s->refs[e->first];
+    n = e->count;
+    id = r->id;
+    
+    // first ref >= id, or > id for next
+    for(start = 0; start < n && (refs[start] < id ||
+        (refs[start] == id && (mode & MOD_NEXT))); ++start);
+    
+    for(i = 0; i < n; ++i)
+    {
+        switch(mode & MOD_MASK_DIR)
+        {
+            case MOD_ONLY:
+                k = start;
+                if(i || k == n || refs[k] != id)
+                    return (char*) def;
+                break;
+            case MOD_PREV:
+                // last ref < id going down, wrapping to the end
+                k = (start + n - 1 - i) % n;
+                break;
+            default:
+                k = (start + i) % n;
+                break;
+        }
+        if(refs[k] == id && !(mode & (MOD_THIS|MOD_ONLY)))
+            continue;
+        
+        r = &s->records[refs[k]];
+        f = field ? find_field(&r->rec, field) : r->rec.tqh_first;
+        if(f)
+        {
+            rj->rec = r;
+            rj->field = 0;
+            return f->value;
+        }
+    }
+    return (char*) def;
+}
+
+// applies the method of mode to a found record and field
+
+char* mod_apply(int mode, struct chain_record* r, struct chain_field* modf,
+    const char* field, const char* elem1, const char* elem2, struct recordjar* rj)
+{
+    struct jar* j = (struct jar*) rj->jar;
+    struct chain_field* f;
+    
+    if(rj->index && !(mode & MOD_GET))
+        return 0;
+    if(mode & (MOD_SET|MOD_APP|MOD_ADD|MOD_DEL))
+        dirty(rj, r);
     switch(mode & MOD_MASK_METHOD)
     {
         case MOD_GET:
             return modf->value;
         case MOD_SET:
-            modf->value = (char*) malloc((strlen(elem1)+1)*sizeof(char));
-            strcpy(modf->value, elem1);
-            return f->value;
+        {
+            // elem1 may point into the old value, which is kept if it fits
+            size_t len = strlen(elem1);
+            memmove(escape_alloc(&modf->value, &modf->len, &modf->size, len, 0), elem1, len+1);
+            journal_log(rj, 'S', r, modf->field, modf->value, 0);
+            return modf->value;
+        }
         case MOD_APP:
         {
-            int len = strlen(modf->value);
-            int dlen = strlen(elem2);
-            modf->value = (char*) realloc(modf->value, (len+dlen+strlen(elem1)+1)*sizeof(char));
-            strcpy(modf->value+len, elem2);
-            strcpy(modf->value+len+dlen, elem1);
-            return f->value;
+            size_t len = strlen(elem1);
+            size_t dlen = strlen(elem2);
+            char* dptr = escape_alloc(&modf->value, &modf->len, &modf->size, dlen+len, 1);
+            memcpy(dptr, elem2, dlen);
+            memcpy(dptr+dlen, elem1, len+1);
+            journal_log(rj, 'P', r, modf->field, elem2, elem1);
+            return modf->value;
         }
         case MOD_DEL:
-            free(modf->field);
-            free(modf->value);
-            TAILQ_REMOVE(&r->rec, modf, chain);
-            free(modf);
-            return (char*) key;
+            journal_log(rj, 'D', r, modf->field, 0, 0);
+            free_field(&r->rec, modf);
+            return 0;
         case MOD_DEL_REC:
-            f = r->rec.tqh_first;
-            while(f)
+            journal_log(rj, 'R', r, 0, 0, 0);
+            if(rj->rec == r)
             {
-                free(f->field);
-                free(f->value);
-                TAILQ_REMOVE(&r->rec, f, chain);
-                free(f);
-                f = r->rec.tqh_first;
+                rj->rec = 0;
+                rj->field = 0;
             }
-            CIRCLEQ_REMOVE(j, r, chain);
-            rj->rec = j->cqh_first;
-            free(r);
-            return (char*) key;
+            free_record(rj, r);
+            if(!rj->rec)
+                rj->rec = j->cqh_first != (void*)j ? j->cqh_first : 0;
+            --rj->size;
+            return 0;
         case MOD_ADD:
-            f = (struct chain_field*) malloc(sizeof(struct chain_field));
-            TAILQ_INSERT_TAIL(&r->rec, f, chain);
-            f->field = (char*) malloc((strlen(field)+1)*sizeof(char));
-            strcpy(f->field, field);
-            f->value = (char*) malloc((strlen(elem1)+1)*sizeof(char));
-            strcpy(f->value, elem1);
+            f = new_field(&r->rec, field, elem1);
+            journal_log(rj, 'A', r, field, elem1, 0);
             return f->value;
     }
     return 0;
@@ -750,6 +1579,9 @@ found:
 
 #ifdef TEST
 
+#include "rj_config.h"
+#include <stddef.h>
+
 struct show_state
 {
     int rc, fc;
@@ -767,6 +1599,202 @@ void show_func(int info, char** field, char** value,
     printf("    field %i: %s: %s\n", ++state->fc, *field, *value);
 }
 
+void count_func(int info, char** field, char** value,
+    void* state, struct recordjar* rj)
+{
+    ++*(int*)state;
+}
+
+// shortens the values of the given field in place
+
+void cut_func(int info, char** field, char** value,
+    void* state, struct recordjar* rj)
+{
+    if(!strcmp(*field, (char*) state) && strlen(*value) > 2)
+        (*value)[2] = 0;
+}
+
+void* count_init(void* state)
+{
+    return calloc(1, sizeof(int));
+}
+
+void count_reduce(void* state, void* part)
+{
+    *(int*)state += *(int*)part;
+    free(part);
+}
+
+int update_func(void* state, struct recordjar* rj)
+{
+    return !rj_set_only(0, 0, "field1", (const char*) state, rj);
+}
+
+void done_func(int result, void* arg)
+{
+    *(int*) arg = result;
+}
+
+void count_done(int result, void* arg)
+{
+    if(!result)
+        ++*(int*) arg; // called from the applier thread only
+}
+
+struct shard_worker
+{
+    pthread_t thread;
+    struct rj_shards* shards;
+    int id, errors;
+};
+
+void* shard_worker_thread(void* arg)
+{
+    struct shard_worker* w = (struct shard_worker*) arg;
+    char key[32], value[32];
+    for(int i = 0; i < 250; ++i)
+    {
+        sprintf(key, "t%i-%i", w->id, i);
+        sprintf(value, "%i", i);
+        rj_shards_add(key, "n", value, w->shards);
+        rj_shards_app(key, "n", "x", "-", w->shards);
+        strcat(value, "-x");
+        char* got = rj_shards_get(key, "n", "", w->shards);
+        w->errors += strcmp(got, value) != 0;
+        free(got);
+    }
+    return 0;
+}
+
+struct producer
+{
+    pthread_t thread;
+    struct rj_queue* queue;
+    int id, *done;
+};
+
+void* producer_thread(void* arg)
+{
+    struct producer* p = (struct producer*) arg;
+    char key[32];
+    for(int i = 0; i < 1000; ++i)
+    {
+        sprintf(key, "%i-%i", p->id, i);
+        rj_queue_submit(RJ_OP_ADD, "key", key, "producer", "value", 0, count_done, p->done, p->queue);
+    }
+    return 0;
+}
+
+struct bound
+{
+    char* name;
+    char code[4];
+    int count;
+    long total;
+    double ratio;
+};
+
+const struct rj_schema bound_schema[] = {
+    {"name",  RJ_TYPE_STRING, offsetof(struct bound, name),  0, RJ_SCHEMA_REQUIRED},
+    {"code",  RJ_TYPE_CHARS,  offsetof(struct bound, code),  4, 0},
+    {"count", RJ_TYPE_INT,    offsetof(struct bound, count), 0, 0},
+    {"total", RJ_TYPE_LONG,   offsetof(struct bound, total), 0, 0},
+    {"ratio", RJ_TYPE_DOUBLE, offsetof(struct bound, ratio), 0, 0},
+};
+
+// binds the records of a file written from text, returns the result
+// of the first bind and the number of records bound
+
+int bind_file(const char* text, struct bound* b, int* count)
+{
+    struct rj_stream rs;
+    int ret;
+    FILE* fp = fopen("bind.test", "w");
+    fputs(text, fp);
+    fclose(fp);
+    if((ret = rj_stream_open("bind.test", "r", &rs)))
+        return ret;
+    ret = rj_stream_bind(b, sizeof(struct bound), count, bound_schema, 5, &rs);
+    rj_stream_close(&rs);
+    return ret;
+}
+
+// test.rj embedded by rjgen, the name is shadowed in main
+
+extern const struct rj_static test;
+
+void static_test(struct recordjar* loaded)
+{
+    struct recordjar rj, out;
+    struct rj_stream rs;
+    
+    rj_init_static(&test, &rj);
+    printf("%i: %i\n", loaded->size, rj.size);
+    printf("value1_r1: %s\n", rj_get("same", "bla", "field1", "not found", &rj));
+    printf("value1_r2: %s\n", rj_get_next("same", "bla", "field1", "not found", &rj));
+    printf("value1_r2: %s\n", rj_get("same", "bla", "field1", "not found", &rj));
+    printf("value1_r1: %s\n", rj_get_prev("same", "bla", "field1", "not found", &rj));
+    printf("value1_r2: %s\n", rj_get_prev("same", "bla", "field1", "not found", &rj));
+    printf("v3: %s\n", rj_get("r3", "v3", "r3", "not found", &rj));
+    printf("not found: %s\n", rj_get("same", "nothere", "field1", "not found", &rj));
+    printf("qwe:123: %s\n", rj_get("field1", "value1_r2", "asd", "not found", &rj));
+    printf("1: %i\n", rj_find("same", "bla", rj_find("same", "bla", 0, &rj), &rj) != 0);
+    
+    // nothing changes a static jar
+    printf("%i: %i\n", EROFS, rj_set("same", "bla", "field1", "x", &rj));
+    printf("%i: %i\n", EROFS, rj_add("new", "record", "field", "x", &rj));
+    printf("%i: %i\n", EROFS, rj_app("same", "bla", "field1", "x", 0, &rj));
+    printf("%i: %i\n", EROFS, rj_del_field("same", "bla", "field1", &rj));
+    printf("%i: %i\n", EROFS, rj_del_record("same", "bla", &rj));
+    printf("%i: %i\n", EROFS, rj_record_set(rj_first(&rj), "field1", "x", &rj));
+    printf("%i: %i\n", EROFS, rj_record_add(rj_first(&rj), "field", "x", &rj));
+    printf("%i: %i\n", EROFS, rj_record_del(rj_first(&rj), &rj));
+    printf("%i: %i\n", -EROFS, rj_del_records_where("same", "bla", 0, 0, &rj));
+    printf("%i: %i\n", -EROFS, rj_update_where("same", "bla", update_func, "x", &rj));
+    printf("%i: %i\n", EROFS, rj_config_set("general", "field1", "x", &rj));
+    printf("%i: %i\n", EROFS, rj_journal("test.rj", "static.test", 1, &rj));
+    printf("%i: %i\n", EROFS, rj_queue_start(&rj, 0));
+    rj_init(&out);
+    printf("%i: %i\n", -EROFS, rj_join(&out, loaded, "same", "same", RJ_JOIN_LEFT, &rj));
+    rj_free(&out);
+    if(!rj_stream_open("test.rj", "r", &rs))
+    {
+        printf("%i: %i\n", EROFS, rj_stream_read(&rj, &rs));
+        rj_stream_close(&rs);
+    }
+    printf("value1_r1: %s\n", rj_get("field2", "value2", "field1", "not found", &rj));
+    printf("%i: %i\n", loaded->size, rj.size);
+    rj_free(&rj);
+}
+
+// output of a command, at most size-1 bytes
+
+char* tool_output(const char* cmd, char* buf, size_t size)
+{
+    FILE* fp = popen(cmd, "r");
+    size_t len = fp ? fread(buf, 1, size-1, fp) : 0;
+    buf[len] = 0;
+    if(fp)
+        pclose(fp);
+    return buf;
+}
+
+// concatenates the values of two fields of every record in jar order
+
+char* join_order(const char* field1, const char* field2, char* buf, struct recordjar* rj)
+{
+    rj_record_t rec;
+    *buf = 0;
+    for(rec = rj_first(rj); rec; rec = rj_record_next(rec, rj))
+    {
+        if(*buf)
+            strcat(buf, " ");
+        strcat(buf, rj_record_get(rec, field1, "", rj));
+        strcat(buf, rj_record_get(rec, field2, "", rj));
+    }
+    return buf;
+}
+
 int main(int argc, char* argv[])
 {
     char* file;
@@ -789,6 +1817,16 @@ int main(int argc, char* argv[])
     state.fc = 0;
     rj_mapfold(show_func, &state, &rj);
     
+    if(test)
+        static_test(&rj);
+    
+    if(test)
+    {
+        int fields = 0;
+        rj_mapfold_parallel(count_func, count_init, count_reduce, &fields, 2, &rj);
+        printf("\n9 fields: %i\n", fields);
+    }
+    
     if(test)
     {
         printf("value1_r1: %s\n", rj_get("same", "bla", "field1", "not found", &rj));
@@ -816,12 +1854,541 @@ int main(int argc, char* argv[])
         rj_app("field2", "value2", "new field", "one", " \\ ", &rj);
         printf("other \\ one: %s\n", rj_get("field2", "value2", "new field", "not found", &rj));
         
+        rj_mapfold(cut_func, "new field", &rj);
+        rj_app("field2", "value2", "new field", "two", " ", &rj);
+        printf("ot two: %s\n", rj_get("field2", "value2", "new field", "not found", &rj));
+        
         rj_del_field("field2", "value2", "field1", &rj);
         printf("not found: %s\n", rj_get("field2", "value2", "field1", "not found", &rj));
         rj_del_record("new one", "new value", &rj);
         printf("not found: %s\n", rj_get("new one", "new value", "notexisting", "not found", &rj));
         
+        rj_record_t rec = rj_find("same", "bla", 0, &rj);
+        printf("value1_r2: %s\n", rj_record_get(rj_find("same", "bla", rec, &rj), "field1", "not found", &rj));
+        rj_record_add(rec, "field3", "value", &rj);
+        rj_record_set(rec, "field3", "handle", &rj);
+        printf("handle: %s\n", rj_get_only(0, 0, "field3", "not found", &rj));
+        printf("1: %i\n", rj_record_prev(rec, &rj) == 0);
+        
+        struct rj_queue queue;
+        int result = -1;
+        if(!rj_queue_start(&rj, &queue))
+        {
+            rj_queue_submit(RJ_OP_SET, "asd", "qwe:123", "field1", "queued", 0, done_func, &result, &queue);
+            rj_queue_stop(&queue);
+        }
+        printf("0: %i\n", result);
+        printf("queued: %s\n", rj_get("asd", "qwe:123", "field1", "not found", &rj));
+        {
+            struct recordjar qj;
+            struct producer producers[4];
+            int done = 0;
+            rj_init(&qj);
+            if(!rj_queue_start(&qj, &queue))
+            {
+                for(int i = 0; i < 4; ++i)
+                {
+                    producers[i].queue = &queue;
+                    producers[i].id = i;
+                    producers[i].done = &done;
+                    pthread_create(&producers[i].thread, 0, producer_thread, &producers[i]);
+                }
+                for(int i = 0; i < 4; ++i)
+                    pthread_join(producers[i].thread, 0);
+                rj_queue_stop(&queue);
+            }
+            printf("4000 4000: %i %i\n", done, qj.size);
+            printf("value: %s\n", rj_get("key", "3-999", "producer", "not found", &qj));
+            rj_free(&qj);
+        }
+        
+        printf("1: %i\n", rj_update_where("same", "bla", update_func, "updated", &rj));
+        printf("updated: %s\n", rj_get("same", "bla", "field1", "not found", &rj));
+        {
+            struct recordjar config;
+            rj_init(&config);
+            printf("0: %i\n", rj_config_set("general", "name", "first", &config));
+            printf("0: %i\n", rj_config_set("general", "name", "second", &config));
+            printf("0: %i\n", rj_config_set("general", "other", "value", &config));
+            printf("0: %i\n", rj_config_set("special", "name", "third", &config));
+            printf("second value: %s %s\n", rj_config_get("general", "name", "not found", &config),
+                rj_config_get("general", "other", "not found", &config));
+            printf("2: %i\n", config.size);
+            rj_free(&config);
+        }
+        struct rj_aggregation count = {RJ_AGG_COUNT, 0, 0};
+        struct recordjar groups;
+        rj_group_by("same", &count, 1, 2, &rj, &groups);
+        printf("2: %s\n", rj_get("same", "bla", "count", "not found", &groups));
+        rj_free(&groups);
+        {
+            struct recordjar sales, streamed;
+            struct chain_record* r;
+            struct rj_stream rs;
+            char value[32];
+            struct rj_aggregation aggs[] = {
+                {RJ_AGG_COUNT, 0, 0},
+                {RJ_AGG_COUNT, "amount", "priced"},
+                {RJ_AGG_SUM, "amount", 0},
+                {RJ_AGG_MIN, "amount", 0},
+                {RJ_AGG_MAX, "amount", "highest"},
+            };
+            rj_init(&sales);
+            for(int i = 0; i < 3000; ++i)
+            {
+                r = new_record(&sales);
+                CIRCLEQ_INSERT_TAIL((struct jar*) sales.jar, r, chain);
+                ++sales.size;
+                sprintf(value, "g%i", i%3);
+                new_field(&r->rec, "group", value);
+                sprintf(value, i%100 ? "%i.5" : "n/a", i);
+                if(i%10 != 5)
+                    new_field(&r->rec, "amount", value);
+            }
+            // amounts are missing for i%10 == 5 and not numeric for i%100 == 0
+            rj_group_by("group", aggs, 5, 4, &sales, &groups);
+            printf("3: %i\n", groups.size);
+            printf("1000: %s\n", rj_get("group", "g0", "count", "not found", &groups));
+            printf("900: %s\n", rj_get("group", "g0", "priced", "not found", &groups));
+            printf("1335445: %s\n", rj_get("group", "g0", "sum_amount", "not found", &groups));
+            printf("1.5: %s\n", rj_get("group", "g1", "min_amount", "not found", &groups));
+            printf("2999.5: %s\n", rj_get("group", "g2", "highest", "not found", &groups));
+            printf("g0 g1 g2: %s\n", join_order("group", "", value, &groups));
+            
+            rj_save("sales.test", &sales);
+            rj_stream_open("sales.test", "r", &rs);
+            printf("0: %i\n", rj_group_by_stream("group", aggs, 5, &rs, &streamed));
+            rj_stream_close(&rs);
+            int same = streamed.size == groups.size;
+            for(rj_record_t a = rj_first(&groups), b = rj_first(&streamed); a && b;
+                a = rj_record_next(a, &groups), b = rj_record_next(b, &streamed))
+            {
+                rj_field_t fa = rj_record_fields(a, &groups), fb = rj_record_fields(b, &streamed);
+                for(; fa && fb; fa = rj_field_next(fa), fb = rj_field_next(fb))
+                    same &= !strcmp(rj_field_name(fa), rj_field_name(fb))
+                        && !strcmp(rj_field_value(fa), rj_field_value(fb));
+                same &= !fa && !fb;
+            }
+            printf("1: %i\n", same);
+            rj_free(&streamed);
+            rj_free(&groups);
+            rj_free(&sales);
+        }
+        
+        {
+            struct recordjar left, right, out;
+            char buf[128];
+            rj_init(&left);
+            rj_init(&right);
+            rj_add("id", "L1", "k", "a", &left);
+            rj_add("id", "L2", "k", "b", &left);
+            rj_add("id", "L3", "k", "c", &left);
+            rj_add("r", "x", "k", "a", &right);
+            rj_add("r", "y", "k", "a", &right);
+            rj_add("r", "z", "k", "c", &right);
+            rj_add("r", "w", "k", "d", &right);
+            printf("L3 L2 L1: %s\n", join_order("id", "", buf, &left));
+            printf("w z y x: %s\n", join_order("r", "", buf, &right));
+            
+            // the left jar is smaller and hashed
+            rj_init(&out);
+            printf("3: %i\n", rj_join(&left, &right, "k", "k", RJ_JOIN_INNER, &out));
+            printf("L3z L1y L1x: %s\n", join_order("id", "r", buf, &out));
+            rj_free(&out);
+            rj_init(&out);
+            printf("4: %i\n", rj_join(&left, &right, "k", "k", RJ_JOIN_LEFT, &out));
+            printf("L3z L2 L1y L1x: %s\n", join_order("id", "r", buf, &out));
+            rj_free(&out);
+            
+            // the right jar is smaller and hashed
+            rj_del_record("r", "w", &right);
+            rj_del_record("r", "y", &right);
+            rj_init(&out);
+            printf("2: %i\n", rj_join(&left, &right, "k", "k", RJ_JOIN_INNER, &out));
+            printf("L3z L1x: %s\n", join_order("id", "r", buf, &out));
+            rj_free(&out);
+            rj_init(&out);
+            printf("3: %i\n", rj_join(&left, &right, "k", "k", RJ_JOIN_LEFT, &out));
+            printf("L3z L2 L1x: %s\n", join_order("id", "r", buf, &out));
+            rj_free(&out);
+            rj_add("r", "x", "id", "R1", &right);
+            rj_init(&out);
+            rj_join(&left, &right, "k", "k", RJ_JOIN_LEFT, &out);
+            printf("L3z L2 L1x: %s\n", join_order("id", "r", buf, &out));
+            rj_free(&out);
+            rj_init(&out);
+            rj_join(&left, &right, "k", "k", RJ_JOIN_MERGE, &out);
+            printf("L3z L2 R1x: %s\n", join_order("id", "r", buf, &out));
+            rj_free(&out);
+            
+            struct rj_stream probe, joined;
+            rj_stream_open("left.test", "w", &probe);
+            for(rj_record_t rec = rj_first(&left); rec; rec = rj_record_next(rec, &left))
+            {
+                left.rec = rec;
+                rj_stream_write(&left, &probe);
+            }
+            rj_stream_close(&probe);
+            rj_stream_open("left.test", "r", &probe);
+            rj_stream_open("joined.test", "w", &joined);
+            printf("0: %i\n", rj_join_stream(&probe, &right, "k", "k", RJ_JOIN_INNER, &joined));
+            rj_stream_close(&probe);
+            rj_stream_close(&joined);
+            rj_load("joined.test", &out);
+            printf("L3z L1x: %s\n", join_order("id", "r", buf, &out));
+            rj_free(&out);
+            rj_stream_open("left.test", "r", &probe);
+            rj_stream_open("joined.test", "w", &joined);
+            printf("0: %i\n", rj_join_stream(&probe, &right, "k", "k", RJ_JOIN_LEFT, &joined));
+            printf("3: %i\n", joined.count);
+            rj_stream_close(&probe);
+            rj_stream_close(&joined);
+            rj_load("joined.test", &out);
+            printf("L3z L2 L1x: %s\n", join_order("id", "r", buf, &out));
+            rj_free(&out);
+            rj_free(&left);
+            rj_free(&right);
+        }
+        
+        {
+            struct bound b[4];
+            struct rj_stream rs;
+            int count = 4;
+            printf("0: %i\n", bind_file("name: one\ncode: abc\ncount: -7\ntotal: 4000000000\n"
+                "ratio: 0.25\nskipped: x\n%%\nname: two\n", b, &count));
+            printf("2: %i\n", count);
+            printf("one abc -7 4000000000 0.25: %s %s %i %li %g\n",
+                b[0].name, b[0].code, b[0].count, b[0].total, b[0].ratio);
+            printf("two  0 0 0: %s %s %i %li %g\n",
+                b[1].name, b[1].code, b[1].count, b[1].total, b[1].ratio);
+            free(b[0].name);
+            free(b[1].name);
+            
+            // records are bound in batches until the end of the stream
+            rj_stream_open("bind.test", "r", &rs);
+            count = 1;
+            printf("0 1: %i", rj_stream_bind(b, sizeof(struct bound), &count, bound_schema, 5, &rs));
+            printf(" %i\n", count);
+            free(b[0].name);
+            printf("0 1: %i", rj_stream_bind(b, sizeof(struct bound), &count, bound_schema, 5, &rs));
+            printf(" %i\n", count);
+            free(b[0].name);
+            printf("end of file 0: %s", rj_strerror(rj_stream_bind(b, sizeof(struct bound), &count, bound_schema, 5, &rs)));
+            printf(" %i\n", count);
+            rj_stream_close(&rs);
+            
+            const char* mismatches[] = {
+                "name: one\n%%\ncode: abc\n",   // required name missing
+                "name: one\n%%\nname: two\ncode: abcd\n",
+                "name: one\n%%\nname: two\ncount: 3000000000\n",
+                "name: one\n%%\nname: two\ntotal: 12x\n",
+                "name: one\n%%\nname: two\nratio: 1/4\n",
+            };
+            for(int i = 0; i < 5; ++i)
+            {
+                count = 4;
+                printf("schema mismatch 1: %s", rj_strerror(bind_file(mismatches[i], b, &count)));
+                printf(" %i\n", count);
+                free(b[0].name);
+            }
+        }
+        
+        struct rj_shards shards;
+        if(!rj_shards_load("test.shard", 2, "same", &shards))
+        {
+            rj_shards_add("bla", "field1", "sharded", &shards);
+            char* value = rj_shards_get("bla", "field1", "not found", &shards);
+            printf("sharded: %s\n", value);
+            free(value);
+            rj_shards_free(&shards);
+        }
+        {
+            struct recordjar users;
+            struct chain_record* r;
+            struct shard_worker workers[4];
+            char value[32];
+            int fields;
+            rj_init(&users);
+            for(int i = 0; i < 400; ++i)
+            {
+                r = new_record(&users);
+                CIRCLEQ_INSERT_TAIL((struct jar*) users.jar, r, chain);
+                ++users.size;
+                sprintf(value, "u%i", i);
+                new_field(&r->rec, "user", value);
+                sprintf(value, "%i", i);
+                new_field(&r->rec, "n", value);
+            }
+            printf("0: %i\n", rj_shards_split("shards.test", 4, "user", &users));
+            rj_free(&users);
+            printf("0: %i\n", rj_shards_load("shards.test", 4, "user", &shards));
+            fields = 0;
+            rj_shards_mapfold(count_func, count_init, count_reduce, &fields, 2, &shards);
+            printf("800: %i\n", fields);
+            char* got = rj_shards_get("u123", "n", "not found", &shards);
+            printf("123: %s\n", got);
+            free(got);
+            
+            for(int i = 0; i < 4; ++i)
+            {
+                workers[i].shards = &shards;
+                workers[i].id = i;
+                workers[i].errors = 0;
+                pthread_create(&workers[i].thread, 0, shard_worker_thread, &workers[i]);
+            }
+            for(int i = 0; i < 4; ++i)
+            {
+                pthread_join(workers[i].thread, 0);
+                printf("0: %i\n", workers[i].errors);
+            }
+            printf("0: %i\n", rj_shards_save(&shards));
+            rj_shards_free(&shards);
+            
+            printf("0: %i\n", rj_shards_load("shards.test", 4, "user", &shards));
+            fields = 0;
+            rj_shards_mapfold(count_func, count_init, count_reduce, &fields, 0, &shards);
+            printf("2800: %i\n", fields);
+            got = rj_shards_get("t3-249", "n", "not found", &shards);
+            printf("249-x: %s\n", got);
+            free(got);
+            // the shard field stays, so the collection loads again
+            printf("%i: %i\n", EINVAL, rj_shards_del_field("u3", "user", &shards));
+            printf("%i: %i\n", EINVAL, rj_shards_set("u3", "user", "u4", &shards));
+            printf("%i: %i\n", EINVAL, rj_shards_app("u3", "user", "x", 0, &shards));
+            printf("0: %i\n", rj_shards_set("u3", "n", "three", &shards));
+            printf("0: %i\n", rj_shards_save(&shards));
+            rj_shards_free(&shards);
+            printf("0: %i\n", rj_shards_load("shards.test", 4, "user", &shards));
+            got = rj_shards_get("u3", "n", "not found", &shards);
+            printf("three: %s\n", got);
+            free(got);
+            rj_shards_free(&shards);
+            
+            printf("shard mismatch: %s\n", rj_strerror(rj_shards_load("shards.test", 3, "user", &shards)));
+            printf("shard mismatch: %s\n", rj_strerror(rj_shards_load("shards.test", 4, "n", &shards)));
+            for(int i = 0; i < 4; ++i)
+            {
+                sprintf(value, "shards.test.%i", i);
+                remove(value);
+            }
+        }
+        
+        printf("2: %i\n", rj_del_records_where("same", "bla", 0, 0, &rj));
+        printf("1: %i\n", rj.size);
+        
         rj_save("test.test", &rj) ? printf("not saved\n") : printf("saved\n");
+        rj_save_parallel("test.test", 2, &rj) ? printf("not saved\n") : printf("saved\n");
+        {
+            // more records than one chunk, so several threads write
+            struct recordjar big;
+            struct chain_record* r;
+            char value[32];
+            rj_init(&big);
+            for(int i = 0; i < 3*SAVE_CHUNK+17; ++i)
+            {
+                // new records are prepended, no search needed
+                r = new_record(&big);
+                CIRCLEQ_INSERT_HEAD((struct jar*) big.jar, r, chain);
+                ++big.size;
+                sprintf(value, "%i", i);
+                new_field(&r->rec, "id", value);
+                new_field(&r->rec, "escaped", "a\\b\n%%c");
+            }
+            rj_save("sequential.test", &big);
+            printf("0: %i\n", rj_save_parallel("parallel.test", 4, &big));
+            rj_free(&big);
+            FILE *a = fopen("sequential.test", "r"), *b = fopen("parallel.test", "r");
+            int ca, cb;
+            long bytes = 0;
+            do
+            {
+                ca = fgetc(a);
+                cb = fgetc(b);
+                ++bytes;
+            } while(ca == cb && ca != EOF);
+            printf("identical: %s\n", ca == cb ? "identical" : "different");
+            printf("1: %i\n", bytes > 3*SAVE_CHUNK*20);
+            fclose(a);
+            fclose(b);
+        }
+        
+        struct rj_stream rs;
+        struct recordjar sj;
+        rj_init(&sj);
+        if(!rj_stream_open("stream.test", "w", &rs))
+        {
+            rj_add("id", "1", "value", "one\ntwo", &sj);
+            rj_stream_write(&sj, &rs);
+            rj_add("id", "2", "value", "%% no comment", &sj);
+            rj_stream_write(&sj, &rs);
+            printf("2: %i\n", rs.count);
+            printf("0: %i\n", rj_stream_close(&rs));
+        }
+        rj_free(&sj);
+        rj_init(&sj);
+        if(!rj_stream_open("stream.test", "r", &rs))
+        {
+            printf("0: %i\n", rj_stream_read(&sj, &rs));
+            printf("1: %i\n", !strcmp(rj_get_only(0, 0, "value", "", &sj), "one\ntwo"));
+            rj_del_record_only(0, 0, &sj);
+            printf("0: %i\n", rj_stream_read(&sj, &rs));
+            printf("%%%% no comment: %s\n", rj_get_only("id", "2", "value", "not found", &sj));
+            printf("end of file: %s\n", rj_strerror(rj_stream_read(&sj, &rs)));
+            printf("2 1: %i %i\n", rs.count, sj.size);
+            rj_stream_close(&rs);
+        }
+        rj_free(&sj);
+        printf("No such file or directory: %s\n", rj_strerror(rj_stream_open("nonexisting.test", "r", &rs)));
+        {
+            char out[256];
+            printf("3: %s", tool_output("./rjtool -c test.rj", out, sizeof(out)));
+            printf("2: %s", tool_output("./rjtool -c -w same=bla test.rj", out, sizeof(out)));
+            printf("1: %s", tool_output("./rjtool -c -w field1!=value1_r1 test.rj", out, sizeof(out)));
+            printf("1: %s", tool_output("./rjtool -c -w !field1 test.rj", out, sizeof(out)));
+            printf("1: %s", tool_output("./rjtool -c -w same -w asd test.rj", out, sizeof(out)));
+            printf("6: %s", tool_output("./rjtool -c test.rj test.rj", out, sizeof(out)));
+            // records without any projected field are dropped
+            printf("1: %i\n", !strcmp(tool_output("./rjtool -f r3,asd test.rj", out, sizeof(out)),
+                "%%encoding: US-ASCII\nasd: qwe:123\n%%\nr3: v3\n"));
+            printf("1: %i\n", !strcmp(tool_output("./rjtool -w same -f field1 test.rj", out, sizeof(out)),
+                "%%encoding: US-ASCII\nfield1: value1_r1\n%%\nfield1: value1_r2\n"));
+            printf("./rjtool: nonexisting.test: No such file or directory\n%s",
+                tool_output("./rjtool -c test.rj nonexisting.test 2>&1 >/dev/null", out, sizeof(out)));
+        }
+        
+        rj_init(&sj);
+        if(!rj_stream_open("unsorted.test", "w", &rs))
+        {
+            char key[16], order[16];
+            for(int i = 0; i < 200; ++i)
+            {
+                sprintf(key, "k%02i", i*37%50);
+                sprintf(order, "%i", i);
+                rj_add(i%20 ? "key" : "nokey", key, "order", order, &sj);
+                rj_stream_write(&sj, &rs);
+                rj_del_record_only(0, 0, &sj);
+            }
+            rj_stream_close(&rs);
+        }
+        rj_free(&sj);
+        // a budget of 512 bytes spills the input into several runs
+        printf("0: %i\n", rj_sort_file("unsorted.test", "runs.test", "key", 512));
+        printf("0: %i\n", rj_sort_file("unsorted.test", "memory.test", "key", 1<<20));
+        {
+            struct rj_stream a, b;
+            struct recordjar ra, rb;
+            int same = 1, sorted = 1, count = 0;
+            char last[16] = "";
+            rj_init(&ra);
+            rj_init(&rb);
+            rj_stream_open("runs.test", "r", &a);
+            rj_stream_open("memory.test", "r", &b);
+            while(!rj_stream_read(&ra, &a))
+            {
+                char* key = rj_get_only(0, 0, "key", "~", &ra);
+                ++count;
+                if(rj_stream_read(&rb, &b) ||
+                    strcmp(rj_get_only(0, 0, "order", "", &ra), rj_get_only(0, 0, "order", "", &rb)))
+                    same = 0;
+                if(strcmp(last, key) > 0)
+                    sorted = 0;
+                strcpy(last, key);
+                rj_del_record_only(0, 0, &ra);
+                rj_del_record_only(0, 0, &rb);
+            }
+            printf("200 1 1: %i %i %i\n", count, sorted, same);
+            rj_stream_close(&a);
+            rj_stream_close(&b);
+            rj_free(&ra);
+            rj_free(&rb);
+        }
+        
+        struct recordjar jr;
+        rj_init(&jr);
+        rj_add("id", "1", "value", "one", &jr);
+        rj_add("id", "2", "value", "two", &jr);
+        rj_save("journal.test", &jr);
+        rj_free(&jr);
+        remove("journal.log.test");
+        rj_load("journal.test", &jr);
+        printf("0: %i\n", rj_journal("journal.test", "journal.log.test", 1, &jr));
+        rj_set("id", "1", "value", "uno", &jr);
+        rj_app("id", "2", "value", "dos", "/", &jr);
+        rj_add("id", "3", "value", "three", &jr);
+        rj_del_field("id", "2", "id", &jr);
+        rj_free(&jr); // without checkpoint
+        rj_load("journal.test", &jr);
+        printf("not found: %s\n", rj_get("id", "3", "value", "not found", &jr));
+        printf("0: %i\n", rj_journal("journal.test", "journal.log.test", 1, &jr));
+        printf("uno: %s\n", rj_get("id", "1", "value", "not found", &jr));
+        printf("two/dos: %s\n", rj_get("value", "two/dos", "value", "not found", &jr));
+        printf("three: %s\n", rj_get("id", "3", "value", "not found", &jr));
+        printf("3: %i\n", jr.size);
+        printf("0: %i\n", rj_checkpoint(&jr));
+        rj_set("id", "3", "value", "tres", &jr);
+        rj_free(&jr);
+        rj_load("journal.test", &jr);
+        printf("three: %s\n", rj_get("id", "3", "value", "not found", &jr));
+        printf("0: %i\n", rj_journal("journal.test", "journal.log.test", 1, &jr));
+        printf("tres: %s\n", rj_get("id", "3", "value", "not found", &jr));
+        printf("uno: %s\n", rj_get("id", "1", "value", "not found", &jr));
+        rj_free(&jr);
+        
+        // records read from a stream or joined are journaled as a whole
+        rj_load("journal.test", &jr);
+        remove("journal.log.test");
+        printf("0: %i\n", rj_journal("journal.test", "journal.log.test", 1, &jr));
+        if(!rj_stream_open("stream.test", "r", &rs))
+        {
+            printf("0: %i\n", rj_stream_read(&jr, &rs));
+            rj_stream_close(&rs);
+        }
+        printf("0: %i\n", rj_add("id", "4", "value", "four", &jr));
+        {
+            struct recordjar names, numbers;
+            rj_init(&names);
+            rj_init(&numbers);
+            rj_add("id", "5", "name", "fuenf", &names);
+            rj_add("id", "5", "value", "five", &numbers);
+            printf("1: %i\n", rj_join(&names, &numbers, "id", "id", RJ_JOIN_INNER, &jr));
+            rj_free(&names);
+            rj_free(&numbers);
+        }
+        printf("0: %i\n", rj_set("id", "3", "value", "after", &jr));
+        rj_free(&jr);
+        rj_load("journal.test", &jr);
+        printf("0: %i\n", rj_journal("journal.test", "journal.log.test", 1, &jr));
+        printf("1: %i\n", !strcmp(rj_get("id", "1", "value", "", &jr), "one\ntwo"));
+        printf("four: %s\n", rj_get("id", "4", "value", "not found", &jr));
+        printf("five: %s\n", rj_get("name", "fuenf", "value", "not found", &jr));
+        printf("after: %s\n", rj_get("id", "3", "value", "not found", &jr));
+        printf("6: %i\n", jr.size);
+        rj_free(&jr);
+        
+        struct recordjar lazy;
+        if(!rj_open(file, 0, &lazy))
+        {
+            printf("value1_r2: %s\n", rj_get("asd", "qwe:123", "field1", "not found", &lazy));
+            printf("v3: %s\n", rj_get("r3", 0, "r3", "not found", &lazy));
+            printf("value1_r1: %s\n", rj_get("field2", "value2", "field1", "not found", &lazy));
+            
+            // budget 0 spills every modified record but the last
+            rj_set("r3", 0, "r3", "v3 spilled", &lazy);
+            rj_set("asd", "qwe:123", "field1", "value1 spilled", &lazy);
+            rj_add("r3", 0, "spill", "added", &lazy);
+            printf("v3 spilled: %s\n", rj_get("r3", 0, "r3", "not found", &lazy));
+            printf("value1 spilled: %s\n", rj_get("asd", "qwe:123", "field1", "not found", &lazy));
+            printf("added: %s\n", rj_get("r3", 0, "spill", "not found", &lazy));
+            if(!rj_save("lazy.test", &lazy))
+            {
+                struct recordjar saved;
+                rj_load("lazy.test", &saved);
+                printf("v3 spilled: %s\n", rj_get("r3", 0, "r3", "not found", &saved));
+                printf("value1 spilled: %s\n", rj_get("asd", "qwe:123", "field1", "not found", &saved));
+                rj_free(&saved);
+            }
+            rj_free(&lazy);
+        }
     }
     
     rj_free(&rj);
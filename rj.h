@@ -25,6 +25,12 @@
 #ifndef __RJ_H__
 #define __RJ_H__
 
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
 #define RJ_INFO_REC_FIRST 1
 #define RJ_INFO_REC_LAST  2
 #define RJ_INFO_FLD_FIRST 4
@@ -32,27 +38,172 @@
 
 #define RJ_ERROR_ENCODING_INVALID       -1
 #define RJ_ERROR_ENCODING_UNSUPPORTED   -2
+#define RJ_ERROR_JOURNAL_INVALID        -3
+#define RJ_EOF                          -4
+#define RJ_ERROR_SCHEMA_MISMATCH        -5
+#define RJ_ERROR_SHARD_MISMATCH         -6
+
+#define RJ_JOIN_INNER 0
+#define RJ_JOIN_LEFT  1
+#define RJ_JOIN_MERGE 2
+
+#define RJ_OP_SET        1
+#define RJ_OP_APP        2
+#define RJ_OP_ADD        3
+#define RJ_OP_DEL_FIELD  4
+#define RJ_OP_DEL_RECORD 5
+
+#define RJ_AGG_COUNT 1
+#define RJ_AGG_SUM   2
+#define RJ_AGG_MIN   3
+#define RJ_AGG_MAX   4
+
+#define RJ_TYPE_STRING 1
+#define RJ_TYPE_CHARS  2
+#define RJ_TYPE_INT    3
+#define RJ_TYPE_LONG   4
+#define RJ_TYPE_DOUBLE 5
+
+#define RJ_SCHEMA_REQUIRED 1
 
 struct recordjar
 {
     int size;
     void *jar, *rec, *field;
+    void *cache, *journal, *index;
+};
+
+struct rj_static;
+
+struct rj_stream
+{
+    int count;
+    void *stream;
+};
+
+struct rj_queue
+{
+    void *queue;
+};
+
+struct rj_shards
+{
+    int count;
+    char *field;
+    void *shards;
+};
+
+struct rj_aggregation
+{
+    int type;
+    const char *field, *name;
+};
+
+struct rj_schema
+{
+    const char* field;
+    int type;
+    size_t offset, size;
+    int flags;
 };
 
+typedef void* rj_record_t;
+typedef void* rj_field_t;
+
 typedef void rj_mapfold_func(int info, char** field, char** value,
     void* state, struct recordjar* rj);
+typedef void* rj_mapfold_init_func(void* state);
+typedef void rj_mapfold_reduce_func(void* state, void* part);
+typedef int rj_where_func(void* state, struct recordjar* rj);
+typedef void rj_done_func(int result, void* arg);
 
 int  rj_load(const char* file, struct recordjar* rj);
+int  rj_open(const char* file, size_t budget, struct recordjar* rj);
 int  rj_save(const char* file, struct recordjar* rj);
+int  rj_save_parallel(const char* file, int threads, struct recordjar* rj);
 void rj_free(struct recordjar* rj);
 void rj_init(struct recordjar* rj);
+void rj_init_static(const struct rj_static* s, struct recordjar* rj);
+
+int  rj_journal(const char* file, const char* journal, int batch, struct recordjar* rj);
+int  rj_journal_sync(struct recordjar* rj);
+int  rj_checkpoint(struct recordjar* rj);
 
 const char *rj_strerror(int error);
 
+int  rj_stream_open(const char* file, const char* mode, struct rj_stream* rs);
+int  rj_stream_read(struct recordjar* rj, struct rj_stream* rs);
+int  rj_stream_write(struct recordjar* rj, struct rj_stream* rs);
+int  rj_stream_close(struct rj_stream* rs);
+int  rj_stream_bind(void* records, size_t size, int* count,
+    const struct rj_schema* schema, int fields, struct rj_stream* rs);
+
+int  rj_queue_start(struct recordjar* rj, struct rj_queue* rq);
+int  rj_queue_submit(int op, const char* key, const char* keyval,
+    const char* field, const char* value, const char* delim,
+    rj_done_func* done, void* arg, struct rj_queue* rq);
+int  rj_queue_stop(struct rj_queue* rq);
+
+int  rj_sort_file(const char* in, const char* out, const char* field, size_t budget);
+
+int  rj_join(struct recordjar* left, struct recordjar* right,
+    const char* left_field, const char* right_field, int mode, struct recordjar* out);
+int  rj_join_stream(struct rj_stream* probe, struct recordjar* build,
+    const char* probe_field, const char* build_field, int mode, struct rj_stream* out);
+
+int  rj_group_by(const char* field, const struct rj_aggregation* aggs, int count,
+    int threads, struct recordjar* rj, struct recordjar* out);
+int  rj_group_by_stream(const char* field, const struct rj_aggregation* aggs, int count,
+    struct rj_stream* rs, struct recordjar* out);
+
 void rj_mapfold(rj_mapfold_func* func, void* state, struct recordjar* rj);
+void rj_mapfold_parallel(rj_mapfold_func* func, rj_mapfold_init_func* init,
+    rj_mapfold_reduce_func* reduce, void* state, int threads, struct recordjar* rj);
+
+int rj_del_records_where(const char* key, const char* keyval,
+    rj_where_func* func, void* state, struct recordjar* rj);
+int rj_update_where(const char* key, const char* keyval,
+    rj_where_func* func, void* state, struct recordjar* rj);
+
+int   rj_shards_load(const char* file, int count, const char* field, struct rj_shards* rs);
+int   rj_shards_save(struct rj_shards* rs);
+int   rj_shards_split(const char* file, int count, const char* field, struct recordjar* rj);
+void  rj_shards_free(struct rj_shards* rs);
+void  rj_shards_mapfold(rj_mapfold_func* func, rj_mapfold_init_func* init,
+    rj_mapfold_reduce_func* reduce, void* state, int threads, struct rj_shards* rs);
+char* rj_shards_get(const char* keyval, const char* field, const char* def, struct rj_shards* rs);
+int   rj_shards_set(const char* keyval, const char* field, const char* value, struct rj_shards* rs);
+int   rj_shards_app(const char* keyval, const char* field, const char* value,
+    const char* delim, struct rj_shards* rs);
+int   rj_shards_add(const char* keyval, const char* field, const char* value, struct rj_shards* rs);
+int   rj_shards_del_field(const char* keyval, const char* field, struct rj_shards* rs);
+int   rj_shards_del_record(const char* keyval, struct rj_shards* rs);
 
 void rj_next(char** field, char** value, struct recordjar* rj);
 
+rj_record_t rj_first(struct recordjar* rj);
+rj_record_t rj_last(struct recordjar* rj);
+rj_record_t rj_record_next(rj_record_t rec, struct recordjar* rj);
+rj_record_t rj_record_prev(rj_record_t rec, struct recordjar* rj);
+rj_record_t rj_find(const char* key, const char* keyval, rj_record_t after, struct recordjar* rj);
+rj_record_t rj_find_len(const char* key, size_t klen, const char* keyval, size_t vlen,
+    rj_record_t after, struct recordjar* rj);
+
+char* rj_record_get(rj_record_t rec, const char* field, const char* def, struct recordjar* rj);
+char* rj_record_get_len(rj_record_t rec, const char* field, size_t len,
+    const char* def, struct recordjar* rj);
+int   rj_record_set(rj_record_t rec, const char* field, const char* value, struct recordjar* rj);
+int   rj_record_app(rj_record_t rec, const char* field, const char* value,
+    const char* delim, struct recordjar* rj);
+int   rj_record_add(rj_record_t rec, const char* field, const char* value, struct recordjar* rj);
+int   rj_record_del_field(rj_record_t rec, const char* field, struct recordjar* rj);
+int   rj_record_del(rj_record_t rec, struct recordjar* rj);
+
+rj_field_t  rj_record_fields(rj_record_t rec, struct recordjar* rj);
+rj_field_t  rj_field_next(rj_field_t field);
+const char* rj_field_name(rj_field_t field);
+const char* rj_field_value(rj_field_t field);
+
 #define RJ_GET(Name) \
     char* rj_##Name( \
         const char* key, const char* keyval, \
@@ -113,4 +264,8 @@ RJ_DEL_FIELD(del_field_next)
 RJ_DEL_FIELD(del_field_prev)
 RJ_DEL_FIELD(del_field_only)
 
+#ifdef __cplusplus
+}
+#endif
+
 #endif
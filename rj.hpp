@@ -0,0 +1,317 @@
+/*
+ * This source file is part of the librj c library.
+ *
+ * Copyright (c) 2014 Martin Rödel aka Yomin
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#ifndef __RJ_HPP__
+#define __RJ_HPP__
+
+// header-only C++17 wrapper over the C API, lookups pass string_views
+// with their length so no NUL terminated temporaries are made, values
+// are returned as string_views into the jar valid until the field is
+// modified or deleted, a default constructed string_view as key or
+// keyval matches always like NULL
+
+#include "rj.h"
+#include <array>
+#include <cstring>
+#include <memory>
+#include <string>
+#include <string_view>
+
+namespace rj
+{
+
+namespace detail
+{
+    // NUL terminated copy for the mutating methods which copy anyway,
+    // short strings stay on the stack
+    class CStr
+    {
+    public:
+        CStr(std::string_view str)
+        {
+            if(!str.data())
+                cstr_ = nullptr;
+            else if(str.size() < sizeof(buf_))
+            {
+                std::memcpy(buf_, str.data(), str.size());
+                buf_[str.size()] = 0;
+                cstr_ = buf_;
+            }
+            else
+            {
+                long_.assign(str);
+                cstr_ = long_.c_str();
+            }
+        }
+        CStr(const CStr&) = delete;
+        CStr& operator=(const CStr&) = delete;
+        
+        operator const char*() const { return cstr_; }
+        
+    private:
+        char buf_[128];
+        std::string long_;
+        const char* cstr_;
+    };
+}
+
+class Field
+{
+public:
+    Field(rj_field_t field = nullptr) : field_(field) {}
+    
+    std::string_view name() const { return rj_field_name(field_); }
+    std::string_view value() const { return rj_field_value(field_); }
+    rj_field_t handle() const { return field_; }
+    
+private:
+    rj_field_t field_;
+};
+
+class FieldIterator
+{
+public:
+    FieldIterator(rj_field_t field = nullptr) : field_(field) {}
+    
+    Field operator*() const { return Field(field_); }
+    FieldIterator& operator++() { field_ = rj_field_next(field_); return *this; }
+    bool operator==(const FieldIterator& other) const { return field_ == other.field_; }
+    bool operator!=(const FieldIterator& other) const { return field_ != other.field_; }
+    
+private:
+    rj_field_t field_;
+};
+
+class Fields
+{
+public:
+    Fields(rj_field_t first) : first_(first) {}
+    
+    FieldIterator begin() const { return FieldIterator(first_); }
+    FieldIterator end() const { return FieldIterator(); }
+    
+private:
+    rj_field_t first_;
+};
+
+// handle to a record valid until the record is deleted
+
+class Record
+{
+public:
+    Record(rj_record_t rec = nullptr, recordjar* rj = nullptr) : rec_(rec), rj_(rj) {}
+    
+    explicit operator bool() const { return rec_ != nullptr; }
+    bool operator==(const Record& other) const { return rec_ == other.rec_; }
+    bool operator!=(const Record& other) const { return rec_ != other.rec_; }
+    
+    Record next() const { return Record(rj_record_next(rec_, rj_), rj_); }
+    Record prev() const { return Record(rj_record_prev(rec_, rj_), rj_); }
+    Fields fields() const { return Fields(rj_record_fields(rec_, rj_)); }
+    
+    std::string_view get(std::string_view field, std::string_view def = {}) const
+    {
+        const char* value = rj_record_get_len(rec_, field.data(), field.size(), nullptr, rj_);
+        return value ? std::string_view(value) : def;
+    }
+    
+    // values of several fields in one pass over the record,
+    // missing fields yield a default constructed string_view
+    template<std::size_t N>
+    std::array<std::string_view, N> get(const std::array<std::string_view, N>& fields) const
+    {
+        std::array<std::string_view, N> values{};
+        for(rj_field_t f = rj_record_fields(rec_, rj_); f; f = rj_field_next(f))
+        {
+            std::string_view name = rj_field_name(f);
+            for(std::size_t i = 0; i < N; ++i)
+                if(!values[i].data() && fields[i] == name)
+                    values[i] = rj_field_value(f);
+        }
+        return values;
+    }
+    
+    int set(std::string_view field, std::string_view value)
+    {
+        return rj_record_set(rec_, detail::CStr(field), detail::CStr(value), rj_);
+    }
+    
+    int app(std::string_view field, std::string_view value, std::string_view delim = {})
+    {
+        return rj_record_app(rec_, detail::CStr(field), detail::CStr(value), detail::CStr(delim), rj_);
+    }
+    
+    int add(std::string_view field, std::string_view value)
+    {
+        return rj_record_add(rec_, detail::CStr(field), detail::CStr(value), rj_);
+    }
+    
+    int del(std::string_view field)
+    {
+        return rj_record_del_field(rec_, detail::CStr(field), rj_);
+    }
+    
+    // invalidates this handle
+    int erase()
+    {
+        return rj_record_del(rec_, rj_);
+    }
+    
+    rj_record_t handle() const { return rec_; }
+    
+private:
+    rj_record_t rec_;
+    recordjar* rj_;
+};
+
+class RecordIterator
+{
+public:
+    RecordIterator(Record rec = Record()) : rec_(rec) {}
+    
+    Record operator*() const { return rec_; }
+    RecordIterator& operator++() { rec_ = rec_.next(); return *this; }
+    bool operator==(const RecordIterator& other) const { return rec_ == other.rec_; }
+    bool operator!=(const RecordIterator& other) const { return rec_ != other.rec_; }
+    
+private:
+    Record rec_;
+};
+
+// owns a jar, the recordjar is kept on the heap so records stay valid
+// when the jar is moved, a moved from jar may only be destroyed or
+// assigned to
+
+class RecordJar
+{
+public:
+    RecordJar() : rj_(new recordjar) { rj_init(rj_.get()); }
+    ~RecordJar() { reset(); }
+    
+    RecordJar(const RecordJar&) = delete;
+    RecordJar& operator=(const RecordJar&) = delete;
+    RecordJar(RecordJar&&) = default;
+    
+    RecordJar& operator=(RecordJar&& other)
+    {
+        if(this != &other)
+        {
+            reset();
+            rj_ = std::move(other.rj_);
+        }
+        return *this;
+    }
+    
+    // the jar is kept unchanged on failure
+    int load(const char* file)
+    {
+        recordjar rj;
+        std::memset(&rj, 0, sizeof(recordjar));
+        return replace(rj_load(file, &rj), rj);
+    }
+    
+    int open(const char* file, std::size_t budget)
+    {
+        recordjar rj;
+        std::memset(&rj, 0, sizeof(recordjar));
+        return replace(rj_open(file, budget, &rj), rj);
+    }
+    
+    int save(const char* file) { return rj_save(file, rj_.get()); }
+    int save_parallel(const char* file, int threads = 0) { return rj_save_parallel(file, threads, rj_.get()); }
+    
+    int size() const { return rj_->size; }
+    
+    Record first() { return Record(rj_first(rj_.get()), rj_.get()); }
+    Record last() { return Record(rj_last(rj_.get()), rj_.get()); }
+    RecordIterator begin() { return RecordIterator(first()); }
+    RecordIterator end() { return RecordIterator(); }
+    
+    // first record after the given one containing key/keyval
+    Record find(std::string_view key, std::string_view keyval = {}, Record after = Record())
+    {
+        return Record(rj_find_len(key.data(), key.size(),
+            keyval.data(), keyval.size(), after.handle(), rj_.get()), rj_.get());
+    }
+    
+    int set(std::string_view key, std::string_view keyval,
+        std::string_view field, std::string_view value)
+    {
+        return rj_set(detail::CStr(key), detail::CStr(keyval),
+            detail::CStr(field), detail::CStr(value), rj_.get());
+    }
+    
+    int app(std::string_view key, std::string_view keyval,
+        std::string_view field, std::string_view value, std::string_view delim = {})
+    {
+        return rj_app(detail::CStr(key), detail::CStr(keyval),
+            detail::CStr(field), detail::CStr(value), detail::CStr(delim), rj_.get());
+    }
+    
+    int add(std::string_view key, std::string_view keyval,
+        std::string_view field, std::string_view value)
+    {
+        return rj_add(detail::CStr(key), detail::CStr(keyval),
+            detail::CStr(field), detail::CStr(value), rj_.get());
+    }
+    
+    int del_field(std::string_view key, std::string_view keyval, std::string_view field)
+    {
+        return rj_del_field(detail::CStr(key), detail::CStr(keyval), detail::CStr(field), rj_.get());
+    }
+    
+    int del_record(std::string_view key, std::string_view keyval)
+    {
+        return rj_del_record(detail::CStr(key), detail::CStr(keyval), rj_.get());
+    }
+    
+    // for the remaining methods of the C API
+    recordjar* handle() { return rj_.get(); }
+    
+private:
+    void reset()
+    {
+        if(rj_ && rj_->jar)
+            rj_free(rj_.get());
+    }
+    
+    int replace(int ret, recordjar& rj)
+    {
+        if(ret)
+        {
+            if(rj.jar)
+                rj_free(&rj);
+            return ret;
+        }
+        reset();
+        *rj_ = rj;
+        return ret;
+    }
+    
+    std::unique_ptr<recordjar> rj_;
+};
+
+}
+
+#endif
@@ -0,0 +1,164 @@
+/*
+ * This source file is part of the librj c library.
+ *
+ * Copyright (c) 2014 Martin Rödel aka Yomin
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#define _GNU_SOURCE
+
+#include "rj_private.h"
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include <errno.h>
+
+// the parser decodes every value into the scratch field,
+// bind_field converts it directly into the struct
+
+struct chain_field* bind_scratch(struct bind* b, const char* field)
+{
+    size_t len = strlen(field);
+    if(len+1 > b->size)
+    {
+        b->size = len+1;
+        b->name = (char*) realloc(b->name, b->size*sizeof(char));
+    }
+    memcpy(b->name, field, len+1);
+    b->scratch.field = b->name;
+    return &b->scratch;
+}
+
+void bind_field(struct bind* b, struct chain_field* f)
+{
+    const struct rj_schema* s;
+    char *dest, *end;
+    int i;
+    
+    for(i = 0; i < b->fields && strcmp(b->schema[i].field, f->field); ++i);
+    if(i == b->fields || b->seen[i] || b->error)
+        return;
+    
+    s = &b->schema[i];
+    dest = b->record + s->offset;
+    b->seen[i] = 1;
+    errno = 0;
+    
+    switch(s->type)
+    {
+        case RJ_TYPE_STRING: // hand over the buffer
+            *(char**) dest = f->value;
+            f->value = 0;
+            f->len = 0;
+            f->size = 0;
+            return;
+        case RJ_TYPE_CHARS:
+            if(f->len >= s->size)
+                break;
+            memcpy(dest, f->value, f->len+1);
+            return;
+        case RJ_TYPE_INT:
+        {
+            long l = strtol(f->value, &end, 10);
+            if(errno || *end || end == f->value || l < INT_MIN || l > INT_MAX)
+                break;
+            *(int*) dest = l;
+            return;
+        }
+        case RJ_TYPE_LONG:
+        {
+            long l = strtol(f->value, &end, 10);
+            if(errno || *end || end == f->value)
+                break;
+            *(long*) dest = l;
+            return;
+        }
+        case RJ_TYPE_DOUBLE:
+        {
+            double d = strtod(f->value, &end);
+            if(errno || *end || end == f->value)
+                break;
+            *(double*) dest = d;
+            return;
+        }
+    }
+    DEBUG(printf("[RJ] bind error field %s\n", f->field));
+    b->error = 1;
+}
+
+void bind_clear(struct bind* b)
+{
+    int i;
+    for(i = 0; i < b->fields; ++i)
+        if(b->schema[i].type == RJ_TYPE_STRING && b->seen[i])
+        {
+            free(*(char**) (b->record + b->schema[i].offset));
+            *(char**) (b->record + b->schema[i].offset) = 0;
+        }
+}
+
+int rj_stream_bind(void* records, size_t size, int* count,
+    const struct rj_schema* schema, int fields, struct rj_stream* rs)
+{
+    struct stream* s = (struct stream*) rs->stream;
+    struct bind b;
+    int i, n = 0, ret = EXIT_SUCCESS;
+    
+    memset(&b, 0, sizeof(struct bind));
+    b.schema = schema;
+    b.fields = fields;
+    b.seen = (char*) malloc(fields ? fields : 1);
+    
+    while(n < *count && !s->p.eof)
+    {
+        b.record = (char*) records + n*size;
+        b.error = 0;
+        memset(b.record, 0, size);
+        memset(b.seen, 0, fields);
+        
+        if((ret = parse_record(&s->p, 0, &b)) <= 0)
+            break;
+        ret = EXIT_SUCCESS;
+        
+        for(i = 0; i < fields && !b.error; ++i)
+            if((schema[i].flags & RJ_SCHEMA_REQUIRED) && !b.seen[i])
+            {
+                DEBUG(printf("[RJ] bind missing field %s\n", schema[i].field));
+                b.error = 1;
+            }
+        if(b.error)
+        {
+            bind_clear(&b);
+            ret = RJ_ERROR_SCHEMA_MISMATCH;
+            break;
+        }
+        ++n;
+        ++rs->count;
+    }
+    
+    free(b.seen);
+    free(b.name);
+    free(b.scratch.value);
+    
+    *count = n;
+    if(ret)
+        return ret;
+    return n || !s->p.eof ? EXIT_SUCCESS : RJ_EOF;
+}
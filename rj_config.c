@@ -31,15 +31,13 @@ char* rj_config_get(const char *section, const char *field, const char *def, str
     return rj_get("section", section, field, def, rj);
 }
 
-void rj_config_set(const char *section, const char *field, const char *value, struct recordjar *rj)
+int rj_config_set(const char *section, const char *field, const char *value, struct recordjar *rj)
 {
-    if(rj_get("section", section, 0, 0, rj))
-    {
-        if(rj_set_only(0, 0, field, value, rj))
-            rj_add(0, 0, field, value, rj);
-    }
-    else
-        rj_add("section", section, field, value, rj);
+    if(!rj_get("section", section, 0, 0, rj))
+        return rj_add("section", section, field, value, rj);
+    if(!rj_get_only(0, 0, field, 0, rj))
+        return rj_add(0, 0, field, value, rj);
+    return rj_set_only(0, 0, field, value, rj);
 }
 
 int rj_config_list(const char *section, struct recordjar *rj)
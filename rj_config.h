@@ -27,10 +27,18 @@
 
 #include "rj.h"
 
+#ifdef __cplusplus
+extern "C" {
+#endif
+
 char* rj_config_get(const char *section, const char *field, const char *def, struct recordjar *rj);
-void  rj_config_set(const char *section, const char *field, const char *value, struct recordjar *rj);
+int   rj_config_set(const char *section, const char *field, const char *value, struct recordjar *rj);
 
 int  rj_config_list(const char *section, struct recordjar *rj);
 void rj_config_next(char **field, char **value, struct recordjar *rj);
 
+#ifdef __cplusplus
+}
+#endif
+
 #endif
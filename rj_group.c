@@ -0,0 +1,302 @@
+/*
+ * This source file is part of the librj c library.
+ *
+ * Copyright (c) 2014 Martin Rödel aka Yomin
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#define _GNU_SOURCE
+
+#include "rj_private.h"
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+
+struct group_agg
+{
+    double value;
+    long count;
+};
+
+struct group
+{
+    struct group* next;
+    char* value;
+    struct group_agg aggs[];
+};
+
+// groups are hashed by value and listed in order of first appearance
+
+struct group_table
+{
+    const char* field;
+    const struct rj_aggregation* aggs;
+    int count;
+    struct hash h;
+    struct group *first, *last;
+    const char** values;
+};
+
+void group_init_table(struct group_table* t, const char* field,
+    const struct rj_aggregation* aggs, int count)
+{
+    t->field = field;
+    t->aggs = aggs;
+    t->count = count;
+    hash_init(&t->h, 0);
+    t->first = t->last = 0;
+    t->values = (const char**) malloc((count ? count : 1)*sizeof(const char*));
+}
+
+void group_free_table(struct group_table* t)
+{
+    struct group* g;
+    while((g = t->first))
+    {
+        t->first = g->next;
+        free(g);
+    }
+    hash_free(&t->h);
+    free(t->values);
+}
+
+struct group* group_get(struct group_table* t, const char* value)
+{
+    struct hash_entry* e = hash_get(&t->h, value, 1);
+    struct group* g = (struct group*) e->value;
+    size_t len;
+    
+    if(g)
+        return g;
+    
+    // the value is copied behind the aggregates and keys the entry
+    len = strlen(value)+1;
+    g = (struct group*) malloc(sizeof(struct group) + t->count*sizeof(struct group_agg) + len);
+    memset(g->aggs, 0, t->count*sizeof(struct group_agg));
+    g->value = (char*) &g->aggs[t->count];
+    memcpy(g->value, value, len);
+    g->next = 0;
+    e->key = g->value;
+    e->value = g;
+    
+    if(t->last)
+        t->last->next = g;
+    else
+        t->first = g;
+    t->last = g;
+    return g;
+}
+
+void group_add(struct group_agg* a, int type, double value, long count)
+{
+    switch(type)
+    {
+        case RJ_AGG_SUM:
+            a->value += value;
+            break;
+        case RJ_AGG_MIN:
+            if(!a->count || value < a->value)
+                a->value = value;
+            break;
+        case RJ_AGG_MAX:
+            if(!a->count || value > a->value)
+                a->value = value;
+            break;
+    }
+    a->count += count;
+}
+
+// the fields of the record are visited once for the group value and
+// the values of all aggregations, non numeric values are skipped
+
+void group_record(struct group_table* t, struct chain_record* r)
+{
+    struct chain_field* f;
+    const char* key = 0;
+    struct group* g;
+    char* end;
+    double value;
+    int i;
+    
+    memset(t->values, 0, t->count*sizeof(const char*));
+    for(f = r->rec.tqh_first; f; f = f->chain.tqe_next)
+    {
+        if(!key && !strcmp(f->field, t->field))
+            key = f->value;
+        for(i = 0; i < t->count; ++i)
+            if(t->aggs[i].field && !t->values[i] && !strcmp(f->field, t->aggs[i].field))
+                t->values[i] = f->value;
+    }
+    if(!key)
+        return;
+    
+    g = group_get(t, key);
+    for(i = 0; i < t->count; ++i)
+    {
+        if(t->aggs[i].type == RJ_AGG_COUNT)
+        {
+            if(!t->aggs[i].field || t->values[i])
+                ++g->aggs[i].count;
+            continue;
+        }
+        if(!t->values[i])
+            continue;
+        value = strtod(t->values[i], &end);
+        if(end != t->values[i] && !*end)
+            group_add(&g->aggs[i], t->aggs[i].type, value, 1);
+    }
+}
+
+void group_func(int info, char** field, char** value, void* state, struct recordjar* rj)
+{
+    if(info & RJ_INFO_FLD_FIRST)
+        group_record((struct group_table*) state, (struct chain_record*) rj->rec);
+}
+
+void* group_init(void* state)
+{
+    struct group_table* t = (struct group_table*) state;
+    struct group_table* part = (struct group_table*) malloc(sizeof(struct group_table));
+    group_init_table(part, t->field, t->aggs, t->count);
+    return part;
+}
+
+// partial tables are merged in record order, so the order of groups
+// is the same as for a sequential scan
+
+void group_reduce(void* state, void* part)
+{
+    struct group_table* t = (struct group_table*) state;
+    struct group_table* p = (struct group_table*) part;
+    struct group *g, *pg;
+    int i;
+    
+    for(pg = p->first; pg; pg = pg->next)
+    {
+        g = group_get(t, pg->value);
+        for(i = 0; i < t->count; ++i)
+            if(pg->aggs[i].count)
+                group_add(&g->aggs[i], t->aggs[i].type, pg->aggs[i].value, pg->aggs[i].count);
+    }
+    group_free_table(p);
+    free(p);
+}
+
+void group_result(struct group_table* t, struct recordjar* out)
+{
+    struct chain_record* r;
+    struct group* g;
+    char *name, value[32];
+    int i;
+    
+    for(g = t->first; g; g = g->next)
+    {
+        r = new_record(out);
+        CIRCLEQ_INSERT_TAIL((struct jar*) out->jar, r, chain);
+        ++out->size;
+        new_field(&r->rec, t->field, g->value);
+        
+        for(i = 0; i < t->count; ++i)
+        {
+            const struct rj_aggregation* a = &t->aggs[i];
+            if(a->type == RJ_AGG_COUNT)
+                snprintf(value, sizeof(value), "%li", g->aggs[i].count);
+            else if(a->type == RJ_AGG_SUM || g->aggs[i].count)
+                snprintf(value, sizeof(value), "%.15g", g->aggs[i].value);
+            else
+                continue; // no minimum/maximum
+            
+            if(a->name)
+                new_field(&r->rec, a->name, value);
+            else
+            {
+                static const char* types[] = {"", "count", "sum", "min", "max"};
+                if(!a->field)
+                    name = strdup(types[a->type]);
+                else if(asprintf(&name, "%s_%s", types[a->type], a->field) == -1)
+                    name = 0;
+                if(name)
+                    new_field(&r->rec, name, value);
+                free(name);
+            }
+        }
+    }
+    out->rec = t->first ? ((struct jar*) out->jar)->cqh_first : 0;
+}
+
+int group_check(const struct rj_aggregation* aggs, int count)
+{
+    int i;
+    for(i = 0; i < count; ++i)
+    {
+        if(aggs[i].type < RJ_AGG_COUNT || aggs[i].type > RJ_AGG_MAX)
+            return EINVAL;
+        if(aggs[i].type != RJ_AGG_COUNT && !aggs[i].field)
+            return EINVAL;
+    }
+    return EXIT_SUCCESS;
+}
+
+int rj_group_by(const char* field, const struct rj_aggregation* aggs, int count,
+    int threads, struct recordjar* rj, struct recordjar* out)
+{
+    struct group_table t;
+    int ret;
+    
+    rj_init(out);
+    if((ret = group_check(aggs, count)))
+        return ret;
+    
+    group_init_table(&t, field, aggs, count);
+    rj_mapfold_parallel(group_func, group_init, group_reduce, &t, threads, rj);
+    group_result(&t, out);
+    group_free_table(&t);
+    return EXIT_SUCCESS;
+}
+
+int rj_group_by_stream(const char* field, const struct rj_aggregation* aggs, int count,
+    struct rj_stream* rs, struct recordjar* out)
+{
+    struct recordjar in;
+    struct group_table t;
+    int ret;
+    
+    rj_init(out);
+    if((ret = group_check(aggs, count)))
+        return ret;
+    
+    group_init_table(&t, field, aggs, count);
+    rj_init(&in);
+    while(!(ret = rj_stream_read(&in, rs)))
+    {
+        group_record(&t, (struct chain_record*) in.rec);
+        free_record(&in, (struct chain_record*) in.rec);
+        --in.size;
+    }
+    rj_free(&in);
+    
+    if(ret == RJ_EOF)
+    {
+        group_result(&t, out);
+        ret = EXIT_SUCCESS;
+    }
+    group_free_table(&t);
+    return ret;
+}
@@ -0,0 +1,103 @@
+/*
+ * This source file is part of the librj c library.
+ *
+ * Copyright (c) 2014 Martin Rödel aka Yomin
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#include "rj_private.h"
+#include <stdlib.h>
+#include <string.h>
+
+// chained hash table over unique strings owned by the caller
+
+unsigned long hash_str(const char* str)
+{
+    unsigned long hash = 2166136261UL; // FNV-1a
+    while(*str)
+    {
+        hash ^= (unsigned char) *str++;
+        hash *= 16777619UL;
+    }
+    return hash;
+}
+
+void hash_init(struct hash* h, size_t size)
+{
+    h->size = 16;
+    while(h->size < size)
+        h->size *= 2;
+    h->count = 0;
+    h->buckets = (struct hash_entry**) calloc(h->size, sizeof(struct hash_entry*));
+}
+
+void hash_free(struct hash* h)
+{
+    size_t i;
+    for(i = 0; i < h->size; ++i)
+        while(h->buckets[i])
+        {
+            struct hash_entry* e = h->buckets[i];
+            h->buckets[i] = e->next;
+            free(e);
+        }
+    free(h->buckets);
+}
+
+void hash_grow(struct hash* h)
+{
+    size_t size = 2*h->size, i;
+    struct hash_entry** buckets = (struct hash_entry**) calloc(size, sizeof(struct hash_entry*));
+    for(i = 0; i < h->size; ++i)
+        while(h->buckets[i])
+        {
+            struct hash_entry* e = h->buckets[i];
+            h->buckets[i] = e->next;
+            e->next = buckets[e->hash & (size-1)];
+            buckets[e->hash & (size-1)] = e;
+        }
+    free(h->buckets);
+    h->buckets = buckets;
+    h->size = size;
+}
+
+// create != 0 - add a new entry with empty value if the key is missing
+
+struct hash_entry* hash_get(struct hash* h, const char* key, int create)
+{
+    unsigned long hash = hash_str(key);
+    struct hash_entry* e = h->buckets[hash & (h->size-1)];
+    
+    while(e && (e->hash != hash || strcmp(e->key, key)))
+        e = e->next;
+    if(e || !create)
+        return e;
+    
+    if(h->count >= h->size)
+        hash_grow(h);
+    e = (struct hash_entry*) malloc(sizeof(struct hash_entry));
+    e->key = key;
+    e->hash = hash;
+    e->value = 0;
+    e->next = h->buckets[hash & (h->size-1)];
+    h->buckets[hash & (h->size-1)] = e;
+    ++h->count;
+    return e;
+}
@@ -0,0 +1,268 @@
+/*
+ * This source file is part of the librj c library.
+ *
+ * Copyright (c) 2014 Martin Rödel aka Yomin
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#define _GNU_SOURCE
+
+#include "rj_private.h"
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+
+struct join_pair
+{
+    struct join_pair* next;
+    struct chain_record* r;
+};
+
+struct join_match
+{
+    struct join_match* next; // same key in jar order
+    struct chain_record* r;
+    struct join_pair *first, *last; // probed records, if built from the left
+};
+
+struct join
+{
+    struct hash h;
+    struct join_match* matches;
+    char** keys;
+    size_t count;
+};
+
+// hashes the records of the build side by the value of field,
+// matches[i] belongs to the i-th record of the jar
+
+void join_build(struct join* jn, const char* field, struct recordjar* rj)
+{
+    struct jar* j = (struct jar*) rj->jar;
+    struct chain_record* r;
+    size_t i;
+    
+    jn->count = 0;
+    for(r = j->cqh_first; r != (void*)j; r = r->chain.cqe_next)
+        ++jn->count;
+    
+    jn->matches = (struct join_match*) calloc(jn->count+1, sizeof(struct join_match));
+    jn->keys = 0;
+    if(rj->cache) // values of lazy jars do not stay resident
+        jn->keys = (char**) calloc(jn->count+1, sizeof(char*));
+    hash_init(&jn->h, jn->count);
+    
+    // backwards, so prepending keeps equal keys in jar order
+    for(i = jn->count, r = j->cqh_last; r != (void*)j; r = r->chain.cqe_prev)
+    {
+        struct join_match* m = &jn->matches[--i];
+        struct chain_field* f;
+        const char* key;
+        
+        touch(rj, r);
+        if(!(f = find_field(&r->rec, field)))
+            continue;
+        key = f->value;
+        if(jn->keys)
+            key = jn->keys[i] = strdup(key);
+        
+        struct hash_entry* e = hash_get(&jn->h, key, 1);
+        m->r = r;
+        m->next = (struct join_match*) e->value;
+        e->value = m;
+    }
+}
+
+void join_free(struct join* jn)
+{
+    size_t i;
+    if(jn->keys)
+    {
+        for(i = 0; i < jn->count; ++i)
+            free(jn->keys[i]);
+        free(jn->keys);
+    }
+    free(jn->matches);
+    hash_free(&jn->h);
+}
+
+struct join_match* join_probe(struct join* jn, const char* field,
+    struct chain_record* r, struct recordjar* rj)
+{
+    struct chain_field* f;
+    struct hash_entry* e;
+    
+    touch(rj, r);
+    if(!(f = find_field(&r->rec, field)) || !(e = hash_get(&jn->h, f->value, 0)))
+        return 0;
+    return (struct join_match*) e->value;
+}
+
+struct chain_record* join_copy(struct chain_record* r, struct recordjar* rj, struct recordjar* out)
+{
+    struct chain_record* o = new_record(out);
+    struct chain_field* f;
+    
+    touch(rj, r);
+    CIRCLEQ_INSERT_TAIL((struct jar*) out->jar, o, chain);
+    for(f = r->rec.tqh_first; f; f = f->chain.tqe_next)
+        new_field(&o->rec, f->field, f->value);
+    ++out->size;
+    out->rec = o;
+    out->field = 0;
+    return o;
+}
+
+// adds the fields of r missing in o, in merge mode values of o are replaced
+
+void join_merge(struct chain_record* r, struct recordjar* rj, struct chain_record* o, int mode)
+{
+    struct chain_field *f, *of;
+    
+    touch(rj, r);
+    for(f = r->rec.tqh_first; f; f = f->chain.tqe_next)
+    {
+        if(!(of = find_field(&o->rec, f->field)))
+            new_field(&o->rec, f->field, f->value);
+        else if(mode == RJ_JOIN_MERGE)
+            memcpy(escape_alloc(&of->value, &of->len, &of->size, f->len, 0), f->value, f->len+1);
+    }
+}
+
+// the results are produced in order of the left jar, matches of a left
+// record in order of the right jar, whichever side is hashed
+
+int rj_join(struct recordjar* left, struct recordjar* right,
+    const char* left_field, const char* right_field, int mode, struct recordjar* out)
+{
+    struct jar *ljar = (struct jar*) left->jar, *rjar = (struct jar*) right->jar;
+    struct chain_record *r, *o;
+    struct join_match* m;
+    struct join_pair* p;
+    struct join jn;
+    size_t i;
+    int count = 0, ret;
+    
+    if(out->index)
+        return -EROFS;
+    if(right->size <= left->size)
+    {
+        DEBUG(printf("[RJ] join build right\n"));
+        join_build(&jn, right_field, right);
+        for(r = ljar->cqh_first; r != (void*)ljar; r = r->chain.cqe_next)
+        {
+            m = join_probe(&jn, left_field, r, left);
+            if(!m && mode != RJ_JOIN_INNER)
+            {
+                journal_record(out, join_copy(r, left, out));
+                ++count;
+            }
+            for(; m; m = m->next)
+            {
+                o = join_copy(r, left, out);
+                join_merge(m->r, right, o, mode);
+                journal_record(out, o);
+                ++count;
+            }
+        }
+    }
+    else
+    {
+        DEBUG(printf("[RJ] join build left\n"));
+        join_build(&jn, left_field, left);
+        // remember the matches of every left record to produce them in its order
+        for(r = rjar->cqh_first; r != (void*)rjar; r = r->chain.cqe_next)
+        {
+            for(m = join_probe(&jn, right_field, r, right); m; m = m->next)
+            {
+                p = (struct join_pair*) malloc(sizeof(struct join_pair));
+                p->next = 0;
+                p->r = r;
+                if(m->last)
+                    m->last->next = p;
+                else
+                    m->first = p;
+                m->last = p;
+            }
+        }
+        for(i = 0, r = ljar->cqh_first; r != (void*)ljar; r = r->chain.cqe_next, ++i)
+        {
+            if(!jn.matches[i].first && mode != RJ_JOIN_INNER)
+            {
+                journal_record(out, join_copy(r, left, out));
+                ++count;
+            }
+            while((p = jn.matches[i].first))
+            {
+                o = join_copy(r, left, out);
+                join_merge(p->r, right, o, mode);
+                journal_record(out, o);
+                ++count;
+                jn.matches[i].first = p->next;
+                free(p);
+            }
+        }
+    }
+    
+    join_free(&jn);
+    // records are logged as a whole once complete
+    if((ret = journal_error(out)))
+        return -ret;
+    return count;
+}
+
+int rj_join_stream(struct rj_stream* probe, struct recordjar* build,
+    const char* probe_field, const char* build_field, int mode, struct rj_stream* out)
+{
+    struct recordjar in, res;
+    struct chain_record *r, *o;
+    struct join_match* m;
+    struct join jn;
+    int ret;
+    
+    join_build(&jn, build_field, build);
+    rj_init(&in);
+    rj_init(&res);
+    
+    while(!(ret = rj_stream_read(&in, probe)))
+    {
+        r = in.rec;
+        m = join_probe(&jn, probe_field, r, &in);
+        if(!m && mode != RJ_JOIN_INNER)
+            ret = rj_stream_write(&in, out);
+        for(; m && !ret; m = m->next)
+        {
+            o = join_copy(r, &in, &res);
+            join_merge(m->r, build, o, mode);
+            ret = rj_stream_write(&res, out);
+            free_record(&res, o);
+            --res.size;
+        }
+        free_record(&in, r);
+        --in.size;
+        if(ret)
+            break;
+    }
+    
+    rj_free(&in);
+    rj_free(&res);
+    join_free(&jn);
+    return ret == RJ_EOF ? EXIT_SUCCESS : ret;
+}
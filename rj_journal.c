@@ -0,0 +1,340 @@
+/*
+ * This source file is part of the librj c library.
+ *
+ * Copyright (c) 2014 Martin Rödel aka Yomin
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#define _GNU_SOURCE
+
+#include "rj_private.h"
+#include <sys/stat.h>
+#include <unistd.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+
+#define JOURNAL_HEADER "rj-journal"
+#define JOURNAL_PARTS  5
+
+// entry: op \t id [\t field [\t value [\t value]]]
+//
+// N - new record with key field and value
+// A - add field and value
+// S - set field to value
+// P - append delimiter and value to field
+// D - delete field
+// R - delete record
+//
+// records are identified by their position in the base jar, new records
+// get the following ids in order of creation
+
+void journal_number(struct recordjar* rj)
+{
+    struct journal* jl = (struct journal*) rj->journal;
+    struct jar* j = (struct jar*) rj->jar;
+    struct chain_record* r;
+    
+    jl->next = 0;
+    for(r = j->cqh_first; r != (void*)j; r = r->chain.cqe_next)
+        r->id = jl->next++;
+}
+
+int journal_header(struct journal* jl, const char* file)
+{
+    struct stat st;
+    
+    // the header binds the journal to the inode of the base jar, so a
+    // journal already folded in by an interrupted checkpoint is dropped
+    if(stat(file, &st))
+        return errno;
+    // the stream may have been read before, it has to be positioned
+    // before switching to writing
+    if(fflush(jl->fp) || ftruncate(fileno(jl->fp), 0) || fseeko(jl->fp, 0, SEEK_SET))
+        return errno;
+    fprintf(jl->fp, "%s %lu\n", JOURNAL_HEADER, (unsigned long) st.st_ino);
+    return journal_sync(jl);
+}
+
+int journal_replay(struct recordjar* rj)
+{
+    struct journal* jl = (struct journal*) rj->journal;
+    struct jar* j = (struct jar*) rj->jar;
+    struct chain_record *r, **ids;
+    struct chain_field* f;
+    unsigned long count = 0, size = jl->next+1, id;
+    char* line = 0;
+    size_t lsize = 0;
+    ssize_t len;
+    off_t good = ftello(jl->fp);
+    int ret = EXIT_SUCCESS;
+    
+    ids = (struct chain_record**) malloc(size*sizeof(struct chain_record*));
+    for(r = j->cqh_first; r != (void*)j; r = r->chain.cqe_next)
+        ids[count++] = r;
+    
+    while((len = getline(&line, &lsize, jl->fp)) != -1)
+    {
+        char* part[JOURNAL_PARTS];
+        int parts = 0;
+        
+        if(line[len-1] != '\n')
+        {
+            DEBUG(printf("[RJ] journal torn entry\n"));
+            break;
+        }
+        line[len-1] = 0;
+        
+        part[parts++] = line;
+        for(char* c = line; *c && parts < JOURNAL_PARTS; ++c)
+            if(*c == '\t')
+            {
+                *c = 0;
+                part[parts++] = c+1;
+            }
+        for(int i = 2; i < parts; ++i)
+            escape_rev_copy(part[i], part[i]);
+        
+        if(parts < 2 || strlen(part[0]) != 1)
+            goto invalid;
+        id = strtoul(part[1], 0, 10);
+        
+        if(part[0][0] == 'N')
+        {
+            if(parts < 4 || id != jl->next)
+                goto invalid;
+            r = new_record(rj);
+            r->id = jl->next++;
+            CIRCLEQ_INSERT_HEAD(j, r, chain);
+            new_field(&r->rec, part[2], part[3]);
+            ++rj->size;
+            if(count == size)
+            {
+                size *= 2;
+                ids = (struct chain_record**) realloc(ids, size*sizeof(struct chain_record*));
+            }
+            ids[count++] = r;
+        }
+        else
+        {
+            if(id >= count || !(r = ids[id]))
+                goto invalid;
+            touch(rj, r);
+            dirty(rj, r);
+            
+            switch(part[0][0])
+            {
+                case 'A':
+                    if(parts < 4)
+                        goto invalid;
+                    new_field(&r->rec, part[2], part[3]);
+                    break;
+                case 'S':
+                    if(parts < 4 || !(f = find_field(&r->rec, part[2])))
+                        goto invalid;
+                    len = strlen(part[3]);
+                    memcpy(escape_alloc(&f->value, &f->len, &f->size, len, 0), part[3], len+1);
+                    break;
+                case 'P':
+                {
+                    if(parts < 5 || !(f = find_field(&r->rec, part[2])))
+                        goto invalid;
+                    size_t dlen = strlen(part[3]);
+                    len = strlen(part[4]);
+                    char* dptr = escape_alloc(&f->value, &f->len, &f->size, dlen+len, 1);
+                    memcpy(dptr, part[3], dlen);
+                    memcpy(dptr+dlen, part[4], len+1);
+                    break;
+                }
+                case 'D':
+                    if(parts < 3 || !(f = find_field(&r->rec, part[2])))
+                        goto invalid;
+                    free_field(&r->rec, f);
+                    break;
+                case 'R':
+                    free_record(rj, r);
+                    ids[id] = 0;
+                    --rj->size;
+                    break;
+                default:
+                    goto invalid;
+            }
+        }
+        good = ftello(jl->fp);
+        continue;
+        
+invalid:
+        DEBUG(printf("[RJ] journal invalid entry\n"));
+        ret = RJ_ERROR_JOURNAL_INVALID;
+        break;
+    }
+    
+    // drop a partially written last entry before appending
+    if(!ret && (ftruncate(fileno(jl->fp), good) || fseeko(jl->fp, good, SEEK_SET)))
+        ret = errno;
+    
+    rj->rec = j->cqh_first != (void*)j ? j->cqh_first : 0;
+    rj->field = 0;
+    
+    free(ids);
+    if(line)
+        free(line);
+    return ret;
+}
+
+int rj_journal(const char* file, const char* journal, int batch, struct recordjar* rj)
+{
+    struct journal* jl;
+    struct stat st;
+    unsigned long ino;
+    int ret;
+    
+    if(rj->index)
+        return EROFS;
+    if(stat(file, &st))
+        return errno;
+    
+    FILE* fp = fopen(journal, "a+");
+    if(!fp)
+        return errno;
+    
+    jl = (struct journal*) malloc(sizeof(struct journal));
+    memset(jl, 0, sizeof(struct journal));
+    jl->fp = fp;
+    jl->file = strdup(file);
+    jl->batch = batch;
+    rj->journal = jl;
+    journal_number(rj);
+    
+    rewind(fp);
+    if(fscanf(fp, JOURNAL_HEADER " %lu\n", &ino) == 1 && ino == (unsigned long) st.st_ino)
+        ret = journal_replay(rj);
+    else
+    {
+        DEBUG(printf("[RJ] new journal\n"));
+        ret = journal_header(jl, file);
+    }
+    
+    if(ret)
+        journal_close(rj);
+    return ret;
+}
+
+int journal_sync(struct journal* jl)
+{
+    jl->pending = 0;
+    if(fflush(jl->fp) || fdatasync(fileno(jl->fp)))
+        return errno;
+    return EXIT_SUCCESS;
+}
+
+int rj_journal_sync(struct recordjar* rj)
+{
+    struct journal* jl = (struct journal*) rj->journal;
+    return jl ? journal_sync(jl) : EXIT_SUCCESS;
+}
+
+int rj_checkpoint(struct recordjar* rj)
+{
+    return checkpoint(1, rj);
+}
+
+int checkpoint(int threads, struct recordjar* rj)
+{
+    struct journal* jl = (struct journal*) rj->journal;
+    int ret;
+    
+    if(!jl)
+        return EINVAL;
+    if((ret = journal_sync(jl)))
+        return ret;
+    if((ret = save(jl->file, 1, threads, rj)))
+        return ret;
+    if((ret = journal_header(jl, jl->file)))
+        return ret;
+    journal_number(rj);
+    return EXIT_SUCCESS;
+}
+
+void journal_log(struct recordjar* rj, char op, struct chain_record* r,
+    const char* field, const char* value, const char* value2)
+{
+    struct journal* jl = (struct journal*) rj->journal;
+    const char* part[] = {field, value, value2};
+    int ret;
+    
+    if(!jl)
+        return;
+    if(op == 'N')
+        r->id = jl->next++;
+    
+    fprintf(jl->fp, "%c\t%lu", op, r->id);
+    for(int i = 0; i < 3 && part[i]; ++i)
+    {
+        escape(&jl->buf, &jl->len, &jl->size, part[i], 0); // overwrite
+        fprintf(jl->fp, "\t%s", jl->buf);
+    }
+    ret = fputc('\n', jl->fp) == EOF || ferror(jl->fp) ? (errno ? errno : EIO) : 0;
+    
+    if(!ret && ++jl->pending >= jl->batch)
+        ret = journal_sync(jl);
+    // the first error is kept until the method reports it
+    if(ret && !jl->error)
+        jl->error = ret;
+}
+
+// logs a record created as a whole, the first field keys its N entry
+
+void journal_record(struct recordjar* rj, struct chain_record* r)
+{
+    struct chain_field* f = r->rec.tqh_first;
+    
+    if(!rj->journal || !f)
+        return;
+    journal_log(rj, 'N', r, f->field, f->value, 0);
+    for(f = f->chain.tqe_next; f; f = f->chain.tqe_next)
+        journal_log(rj, 'A', r, f->field, f->value, 0);
+}
+
+int journal_error(struct recordjar* rj)
+{
+    struct journal* jl = (struct journal*) rj->journal;
+    int ret = jl ? jl->error : EXIT_SUCCESS;
+    
+    if(jl)
+    {
+        clearerr(jl->fp);
+        jl->error = 0;
+    }
+    return ret;
+}
+
+void journal_close(struct recordjar* rj)
+{
+    struct journal* jl = (struct journal*) rj->journal;
+    
+    journal_sync(jl);
+    fclose(jl->fp);
+    free(jl->file);
+    if(jl->buf)
+        free(jl->buf);
+    free(jl);
+    rj->journal = 0;
+}
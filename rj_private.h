@@ -0,0 +1,201 @@
+/*
+ * This source file is part of the librj c library.
+ *
+ * Copyright (c) 2014 Martin Rödel aka Yomin
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#ifndef __RJ_PRIVATE_H__
+#define __RJ_PRIVATE_H__
+
+#include "rj.h"
+#include <sys/queue.h>
+#include <sys/types.h>
+#include <stdio.h>
+
+#ifndef NDEBUG
+#   define DEBUG(x) x
+#else
+#   define DEBUG(x) while(0)
+#endif
+
+#define RECORD_LOADED 1
+#define RECORD_DIRTY  2
+#define RECORD_SPILLED 4
+
+int trim(char** str);
+int escape(char** dest, size_t* len, size_t* size, const char* src, const char* delim);
+int escape_rev(char** dest, size_t* len, size_t* size, const char* src, const char* delim);
+char* escape_alloc(char** dest, size_t* len, size_t* size, size_t elen, int mode);
+char* escape_rev_copy(char* dest, const char* src);
+
+struct chain_field
+{
+    TAILQ_ENTRY(chain_field) chain;
+    char *field, *value;
+    size_t len, size; // of value
+};
+TAILQ_HEAD(record, chain_field);
+
+struct chain_record
+{
+    CIRCLEQ_ENTRY(chain_record) chain;
+    struct record rec;
+    TAILQ_ENTRY(chain_record) lru;
+    off_t offset;
+    size_t bytes;
+    unsigned long id;
+    int flags;
+};
+CIRCLEQ_HEAD(jar, chain_record);
+TAILQ_HEAD(lru, chain_record);
+
+// jars generated by rjgen, (field, value) pairs are indexed by a
+// perfect hash to the ascending ids of the records containing them,
+// the generated sources initialize these and the chain structures
+// directly, so the version is bumped whenever one of them changes
+
+#define RJ_STATIC_VERSION 1
+
+struct static_entry
+{
+    const char *field, *value;
+    unsigned long first, count; // in refs
+};
+
+struct rj_static
+{
+    struct jar* jar;
+    struct chain_record* records;
+    int size;
+    const struct static_entry* entries;
+    const unsigned long *refs, *disp, *slots;
+    unsigned long buckets, nslots;
+};
+
+#define STATIC_EMPTY ((unsigned long) -1)
+
+unsigned long static_hash(const char* field, const char* value, unsigned long seed);
+const struct static_entry* static_find(const struct rj_static* s, const char* field, const char* value);
+
+struct parser
+{
+    FILE* fp;
+    char* line;
+    size_t size;
+    int encoding, eof;
+};
+
+// clean records are unloaded and dirty ones spilled to a temporary
+// file, least recently used first, while used + pinned exceeds budget
+
+struct cache
+{
+    struct parser p, spill;
+    struct lru lru, dirty;
+    size_t budget, used, pinned;
+    char* buf;
+    size_t len, size;
+};
+
+struct journal
+{
+    FILE* fp;
+    char *file, *buf;
+    size_t len, size;
+    unsigned long next;
+    int batch, pending, error;
+};
+
+struct stream
+{
+    struct parser p;
+    char* buf;
+    size_t len, size;
+    int write;
+};
+
+struct hash_entry
+{
+    struct hash_entry* next;
+    const char* key;
+    unsigned long hash;
+    void* value;
+};
+
+struct hash
+{
+    struct hash_entry** buckets;
+    size_t size, count;
+};
+
+struct bind
+{
+    const struct rj_schema* schema;
+    int fields, error;
+    char *record, *seen, *name;
+    size_t size;
+    struct chain_field scratch;
+};
+
+int parse_record(struct parser* p, struct record* r, struct bind* b);
+struct chain_record* new_record(struct recordjar* rj);
+struct chain_field* new_field(struct record* r, const char* field, const char* value);
+size_t record_bytes(struct chain_record* r);
+void touch(struct recordjar* rj, struct chain_record* r);
+void dirty(struct recordjar* rj, struct chain_record* r);
+int match_record(struct recordjar* rj, struct chain_record* r,
+    const char* key, const char* keyval);
+int match_record_len(struct recordjar* rj, struct chain_record* r,
+    const char* key, size_t klen, const char* keyval, size_t vlen);
+void free_record(struct recordjar* rj, struct chain_record* cr);
+struct chain_field* find_field(struct record* r, const char* field);
+struct chain_field* find_field_len(struct record* r, const char* field, size_t len);
+void free_field(struct record* r, struct chain_field* f);
+void free_fields(struct record* r);
+void unload(struct cache* c, struct chain_record* r);
+void shrink(struct recordjar* rj, struct chain_record* keep);
+void mapfold(struct chain_record* r, int count, rj_mapfold_func* func,
+    void* state, struct recordjar* rj);
+void write_record(FILE* fp, struct chain_record* r, char** buf, size_t* len, size_t* size);
+int save(const char* file, int atomic, int threads, struct recordjar* rj);
+int sync_dir(const char* file);
+
+unsigned long hash_str(const char* str);
+void hash_init(struct hash* h, size_t size);
+void hash_free(struct hash* h);
+struct hash_entry* hash_get(struct hash* h, const char* key, int create);
+
+struct chain_field* bind_scratch(struct bind* b, const char* field);
+void bind_field(struct bind* b, struct chain_field* f);
+
+void stream_attach(FILE* fp, int write, struct rj_stream* rs);
+void stream_rewind(struct rj_stream* rs);
+
+void journal_log(struct recordjar* rj, char op, struct chain_record* r,
+    const char* field, const char* value, const char* value2);
+void journal_record(struct recordjar* rj, struct chain_record* r);
+int  journal_error(struct recordjar* rj);
+int  mod_result(const char* ret, struct recordjar* rj);
+void journal_close(struct recordjar* rj);
+int journal_sync(struct journal* jl);
+int checkpoint(int threads, struct recordjar* rj);
+
+#endif
@@ -0,0 +1,255 @@
+/*
+ * This source file is part of the librj c library.
+ *
+ * Copyright (c) 2014 Martin Rödel aka Yomin
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#define _GNU_SOURCE
+
+#include "rj_private.h"
+#include <pthread.h>
+#include <semaphore.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+
+// producers link their operation into a Vyukov MPSC queue with a single
+// atomic exchange, the applier thread drains it, the semaphore is only
+// posted by the first producer after the applier woke up
+
+struct queue_op
+{
+    struct queue_op* next;
+    int op, result;
+    char *key, *keyval, *field, *value, *delim;
+    rj_done_func* done;
+    void* arg;
+};
+
+struct queue
+{
+    struct queue_op *head, *tail, stub;
+    sem_t sem;
+    pthread_t thread;
+    int stop, signaled;
+    struct recordjar* rj;
+};
+
+void queue_push(struct queue* q, struct queue_op* op)
+{
+    struct queue_op* prev;
+    
+    __atomic_store_n(&op->next, 0, __ATOMIC_RELAXED);
+    prev = __atomic_exchange_n(&q->head, op, __ATOMIC_ACQ_REL);
+    __atomic_store_n(&prev->next, op, __ATOMIC_RELEASE);
+}
+
+// returns 0 if empty or a producer is between exchange and link,
+// its semaphore post follows the link
+
+struct queue_op* queue_pop(struct queue* q)
+{
+    struct queue_op *tail = q->tail, *next;
+    
+    next = __atomic_load_n(&tail->next, __ATOMIC_ACQUIRE);
+    if(tail == &q->stub)
+    {
+        if(!next)
+            return 0;
+        q->tail = tail = next;
+        next = __atomic_load_n(&tail->next, __ATOMIC_ACQUIRE);
+    }
+    if(next)
+    {
+        q->tail = next;
+        return tail;
+    }
+    if(tail != __atomic_load_n(&q->head, __ATOMIC_ACQUIRE))
+        return 0;
+    queue_push(q, &q->stub);
+    next = __atomic_load_n(&tail->next, __ATOMIC_ACQUIRE);
+    if(!next)
+        return 0;
+    q->tail = next;
+    return tail;
+}
+
+int queue_apply(struct queue_op* op, struct recordjar* rj)
+{
+    switch(op->op)
+    {
+        case RJ_OP_SET:
+            return rj_set(op->key, op->keyval, op->field, op->value, rj);
+        case RJ_OP_APP:
+            return rj_app(op->key, op->keyval, op->field, op->value, op->delim, rj);
+        case RJ_OP_ADD:
+            return rj_add(op->key, op->keyval, op->field, op->value, rj);
+        case RJ_OP_DEL_FIELD:
+            return rj_del_field(op->key, op->keyval, op->field, rj);
+        case RJ_OP_DEL_RECORD:
+            return rj_del_record(op->key, op->keyval, rj);
+    }
+    return EINVAL;
+}
+
+// operations are applied in batches in order of submission and are not
+// reordered, a search starts at the record memorized by the previous
+// one, so consecutive mutations of the same record find it at once,
+// the journal is synced once per batch before completions are reported
+
+void* queue_thread(void* arg)
+{
+    struct queue* q = (struct queue*) arg;
+    struct queue_op *op, *first, *last;
+    int count;
+    
+    while(1)
+    {
+        sem_wait(&q->sem);
+        // operations pushed from now on post again, earlier ones are drained
+        __atomic_store_n(&q->signaled, 0, __ATOMIC_SEQ_CST);
+        
+        first = last = 0;
+        count = 0;
+        while((op = queue_pop(q)))
+        {
+            op->result = queue_apply(op, q->rj);
+            op->next = 0;
+            if(last)
+                last->next = op;
+            else
+                first = op;
+            last = op;
+            ++count;
+        }
+        
+        if(count)
+        {
+            DEBUG(printf("[RJ] applied %i queued operations\n", count));
+            rj_journal_sync(q->rj);
+        }
+        
+        while((op = first))
+        {
+            first = op->next;
+            if(op->done)
+                op->done(op->result, op->arg);
+            free(op);
+        }
+        
+        if(__atomic_load_n(&q->stop, __ATOMIC_ACQUIRE) && q->tail == &q->stub
+            && !__atomic_load_n(&q->stub.next, __ATOMIC_ACQUIRE))
+            break;
+    }
+    return 0;
+}
+
+int rj_queue_start(struct recordjar* rj, struct rj_queue* rq)
+{
+    struct queue* q;
+    int ret;
+    
+    if(rj->index)
+        return EROFS;
+    if(!(q = (struct queue*) malloc(sizeof(struct queue))))
+        return ENOMEM;
+    memset(q, 0, sizeof(struct queue));
+    q->head = q->tail = &q->stub;
+    q->rj = rj;
+    
+    if(sem_init(&q->sem, 0, 0))
+    {
+        ret = errno;
+        free(q);
+        return ret;
+    }
+    if((ret = pthread_create(&q->thread, 0, queue_thread, q)))
+    {
+        sem_destroy(&q->sem);
+        free(q);
+        return ret;
+    }
+    
+    rq->queue = q;
+    return EXIT_SUCCESS;
+}
+
+char* queue_copy(char** dest, const char* src)
+{
+    char* copy = *dest;
+    size_t len;
+    
+    if(!src)
+        return 0;
+    len = strlen(src)+1;
+    memcpy(copy, src, len);
+    *dest += len;
+    return copy;
+}
+
+int rj_queue_submit(int op, const char* key, const char* keyval,
+    const char* field, const char* value, const char* delim,
+    rj_done_func* done, void* arg, struct rj_queue* rq)
+{
+    struct queue* q = (struct queue*) rq->queue;
+    struct queue_op* o;
+    size_t size = sizeof(struct queue_op);
+    char* dest;
+    
+    size += key ? strlen(key)+1 : 0;
+    size += keyval ? strlen(keyval)+1 : 0;
+    size += field ? strlen(field)+1 : 0;
+    size += value ? strlen(value)+1 : 0;
+    size += delim ? strlen(delim)+1 : 0;
+    
+    // the strings are copied behind the operation
+    if(!(o = (struct queue_op*) malloc(size)))
+        return ENOMEM;
+    dest = (char*) (o+1);
+    o->op = op;
+    o->key = queue_copy(&dest, key);
+    o->keyval = queue_copy(&dest, keyval);
+    o->field = queue_copy(&dest, field);
+    o->value = queue_copy(&dest, value);
+    o->delim = queue_copy(&dest, delim);
+    o->done = done;
+    o->arg = arg;
+    
+    queue_push(q, o);
+    if(!__atomic_exchange_n(&q->signaled, 1, __ATOMIC_SEQ_CST))
+        sem_post(&q->sem);
+    return EXIT_SUCCESS;
+}
+
+int rj_queue_stop(struct rj_queue* rq)
+{
+    struct queue* q = (struct queue*) rq->queue;
+    int ret;
+    
+    __atomic_store_n(&q->stop, 1, __ATOMIC_RELEASE);
+    sem_post(&q->sem);
+    ret = pthread_join(q->thread, 0);
+    
+    sem_destroy(&q->sem);
+    free(q);
+    rq->queue = 0;
+    return ret;
+}
@@ -0,0 +1,356 @@
+/*
+ * This source file is part of the librj c library.
+ *
+ * Copyright (c) 2014 Martin Rödel aka Yomin
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#define _GNU_SOURCE
+
+#include "rj_private.h"
+#include <pthread.h>
+#include <unistd.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+
+// records are routed by the hash of their value of the shard field,
+// every shard is a jar in its own file guarded by its own lock
+
+struct shard
+{
+    struct recordjar rj;
+    pthread_mutex_t lock;
+    char* file;
+};
+
+typedef int shard_func(struct shard* s, int i, void* arg);
+
+struct shard_run
+{
+    struct rj_shards* rs;
+    shard_func* func;
+    void* arg;
+    int next, ret;
+};
+
+void* shard_thread(void* arg)
+{
+    struct shard_run* run = (struct shard_run*) arg;
+    struct shard* shards = (struct shard*) run->rs->shards;
+    int i, ret, ok;
+    
+    while((i = __atomic_fetch_add(&run->next, 1, __ATOMIC_RELAXED)) < run->rs->count)
+    {
+        ok = EXIT_SUCCESS;
+        if((ret = run->func(&shards[i], i, run->arg)))
+            __atomic_compare_exchange_n(&run->ret, &ok, ret, 0, __ATOMIC_RELAXED, __ATOMIC_RELAXED);
+    }
+    return 0;
+}
+
+// runs func for every shard on up to threads threads including the
+// calling one, returns the first error
+
+int shard_run(shard_func* func, void* arg, int threads, struct rj_shards* rs)
+{
+    struct shard_run run;
+    pthread_t* tids;
+    int i, n = 0;
+    
+    run.rs = rs;
+    run.func = func;
+    run.arg = arg;
+    run.next = 0;
+    run.ret = EXIT_SUCCESS;
+    
+    if(threads <= 0)
+        threads = sysconf(_SC_NPROCESSORS_ONLN);
+    if(threads > rs->count)
+        threads = rs->count;
+    
+    tids = (pthread_t*) malloc((threads > 1 ? threads-1 : 1)*sizeof(pthread_t));
+    for(i = 1; i < threads; ++i)
+        if(!pthread_create(&tids[n], 0, shard_thread, &run))
+            ++n;
+    shard_thread(&run);
+    for(i = 0; i < n; ++i)
+        pthread_join(tids[i], 0);
+    free(tids);
+    return run.ret;
+}
+
+struct shard* shard_lock(const char* keyval, struct rj_shards* rs)
+{
+    struct shard* s = &((struct shard*) rs->shards)[hash_str(keyval) % rs->count];
+    pthread_mutex_lock(&s->lock);
+    return s;
+}
+
+// records without the shard field belong to the first shard
+
+int shard_of(struct chain_record* r, const char* field, int count)
+{
+    struct chain_field* f = find_field(&r->rec, field);
+    return f ? hash_str(f->value) % count : 0;
+}
+
+int shard_load(struct shard* s, int i, void* arg)
+{
+    struct rj_shards* rs = (struct rj_shards*) ((void**) arg)[1];
+    struct jar* j;
+    struct chain_record* r;
+    int ret;
+    
+    if(asprintf(&s->file, "%s.%i", (const char*) ((void**) arg)[0], i) == -1)
+    {
+        s->file = 0;
+        rj_init(&s->rj);
+        return ENOMEM;
+    }
+    
+    // missing shards start empty
+    if((ret = rj_load(s->file, &s->rj)) == ENOENT)
+    {
+        rj_init(&s->rj);
+        ret = EXIT_SUCCESS;
+    }
+    else if(ret && !s->rj.jar)
+        rj_init(&s->rj);
+    if(ret)
+        return ret;
+    
+    // a different count or field would route keys to the wrong shard
+    j = (struct jar*) s->rj.jar;
+    for(r = j->cqh_first; r != (void*)j; r = r->chain.cqe_next)
+        if(shard_of(r, rs->field, rs->count) != i)
+        {
+            DEBUG(printf("[RJ] shard %i holds a record of another shard\n", i));
+            return RJ_ERROR_SHARD_MISMATCH;
+        }
+    return EXIT_SUCCESS;
+}
+
+int rj_shards_load(const char* file, int count, const char* field, struct rj_shards* rs)
+{
+    struct shard* shards;
+    void* arg[2];
+    int i, ret;
+    
+    if(count <= 0)
+        return EINVAL;
+    
+    shards = (struct shard*) calloc(count, sizeof(struct shard));
+    for(i = 0; i < count; ++i)
+        pthread_mutex_init(&shards[i].lock, 0);
+    rs->count = count;
+    rs->field = strdup(field);
+    rs->shards = shards;
+    
+    arg[0] = (void*) file;
+    arg[1] = rs;
+    if((ret = shard_run(shard_load, arg, 0, rs)))
+        rj_shards_free(rs);
+    return ret;
+}
+
+int rj_shards_split(const char* file, int count, const char* field, struct recordjar* rj)
+{
+    struct jar* j = (struct jar*) rj->jar;
+    struct chain_record* r;
+    struct rj_stream* out;
+    void* rec = rj->rec;
+    char* name;
+    int i, k, n, ret = EXIT_SUCCESS;
+    
+    if(count <= 0)
+        return EINVAL;
+    
+    out = (struct rj_stream*) malloc(count*sizeof(struct rj_stream));
+    for(n = 0; n < count; ++n)
+    {
+        if(asprintf(&name, "%s.%i", file, n) == -1)
+        {
+            ret = ENOMEM;
+            break;
+        }
+        ret = rj_stream_open(name, "w", &out[n]);
+        free(name);
+        if(ret)
+            break;
+    }
+    
+    // records are written through the memorized record
+    for(r = j->cqh_first; !ret && r != (void*)j; r = r->chain.cqe_next)
+    {
+        touch(rj, r);
+        rj->rec = r;
+        ret = rj_stream_write(rj, &out[shard_of(r, field, count)]);
+    }
+    
+    for(i = 0; i < n; ++i)
+        if((k = rj_stream_close(&out[i])) && !ret)
+            ret = k;
+    free(out);
+    rj->rec = rec;
+    return ret;
+}
+
+int shard_save(struct shard* s, int i, void* arg)
+{
+    int ret;
+    
+    pthread_mutex_lock(&s->lock);
+    ret = rj_save(s->file, &s->rj);
+    pthread_mutex_unlock(&s->lock);
+    return ret;
+}
+
+int rj_shards_save(struct rj_shards* rs)
+{
+    return shard_run(shard_save, 0, 0, rs);
+}
+
+void rj_shards_free(struct rj_shards* rs)
+{
+    struct shard* shards = (struct shard*) rs->shards;
+    int i;
+    
+    for(i = 0; i < rs->count; ++i)
+    {
+        if(shards[i].rj.jar)
+            rj_free(&shards[i].rj);
+        pthread_mutex_destroy(&shards[i].lock);
+        free(shards[i].file);
+    }
+    free(shards);
+    free(rs->field);
+    memset(rs, 0, sizeof(struct rj_shards));
+}
+
+struct shard_mapfold
+{
+    rj_mapfold_func* func;
+    void** parts;
+};
+
+int shard_mapfold(struct shard* s, int i, void* arg)
+{
+    struct shard_mapfold* m = (struct shard_mapfold*) arg;
+    
+    pthread_mutex_lock(&s->lock);
+    rj_mapfold(m->func, m->parts[i], &s->rj);
+    pthread_mutex_unlock(&s->lock);
+    return EXIT_SUCCESS;
+}
+
+void rj_shards_mapfold(rj_mapfold_func* func, rj_mapfold_init_func* init,
+    rj_mapfold_reduce_func* reduce, void* state, int threads, struct rj_shards* rs)
+{
+    struct shard_mapfold m;
+    int i;
+    
+    m.func = func;
+    m.parts = (void**) malloc(rs->count*sizeof(void*));
+    for(i = 0; i < rs->count; ++i)
+        m.parts[i] = init(state);
+    
+    shard_run(shard_mapfold, &m, threads, rs);
+    
+    // reduce in shard order
+    for(i = 0; i < rs->count; ++i)
+        reduce(state, m.parts[i]);
+    free(m.parts);
+}
+
+// the shard field cannot be changed since the record would have to move
+// to another shard
+
+int shard_field(const char* field, struct rj_shards* rs)
+{
+    return field && !strcmp(field, rs->field);
+}
+
+// values are copied while the shard is locked
+
+char* rj_shards_get(const char* keyval, const char* field, const char* def, struct rj_shards* rs)
+{
+    struct shard* s = shard_lock(keyval, rs);
+    char* value = rj_get(rs->field, keyval, field, def, &s->rj);
+    value = value ? strdup(value) : 0;
+    pthread_mutex_unlock(&s->lock);
+    return value;
+}
+
+int rj_shards_set(const char* keyval, const char* field, const char* value, struct rj_shards* rs)
+{
+    struct shard* s;
+    int ret;
+    
+    if(shard_field(field, rs))
+        return EINVAL;
+    s = shard_lock(keyval, rs);
+    ret = rj_set(rs->field, keyval, field, value, &s->rj);
+    pthread_mutex_unlock(&s->lock);
+    return ret;
+}
+
+int rj_shards_app(const char* keyval, const char* field, const char* value,
+    const char* delim, struct rj_shards* rs)
+{
+    struct shard* s;
+    int ret;
+    
+    if(shard_field(field, rs))
+        return EINVAL;
+    s = shard_lock(keyval, rs);
+    ret = rj_app(rs->field, keyval, field, value, delim, &s->rj);
+    pthread_mutex_unlock(&s->lock);
+    return ret;
+}
+
+int rj_shards_add(const char* keyval, const char* field, const char* value, struct rj_shards* rs)
+{
+    struct shard* s = shard_lock(keyval, rs);
+    int ret = rj_add(rs->field, keyval, field, value, &s->rj);
+    pthread_mutex_unlock(&s->lock);
+    return ret;
+}
+
+int rj_shards_del_field(const char* keyval, const char* field, struct rj_shards* rs)
+{
+    struct shard* s;
+    int ret;
+    
+    if(shard_field(field, rs))
+        return EINVAL;
+    s = shard_lock(keyval, rs);
+    ret = rj_del_field(rs->field, keyval, field, &s->rj);
+    pthread_mutex_unlock(&s->lock);
+    return ret;
+}
+
+int rj_shards_del_record(const char* keyval, struct rj_shards* rs)
+{
+    struct shard* s = shard_lock(keyval, rs);
+    int ret = rj_del_record(rs->field, keyval, &s->rj);
+    pthread_mutex_unlock(&s->lock);
+    return ret;
+}
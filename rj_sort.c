@@ -0,0 +1,366 @@
+/*
+ * This source file is part of the librj c library.
+ *
+ * Copyright (c) 2014 Martin Rödel aka Yomin
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#define _GNU_SOURCE
+
+#include "rj_private.h"
+#include <pthread.h>
+#include <unistd.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+
+#define SORT_CHUNK_MIN 4096
+#define SORT_FANIN     64
+
+struct entry
+{
+    const char* key;
+    size_t order;
+    struct chain_record* r;
+    int source;
+};
+
+struct heap
+{
+    struct entry* items;
+    int count;
+};
+
+struct chunk
+{
+    pthread_t thread;
+    struct entry* entries;
+    size_t count, pos;
+};
+
+const char* sort_key(struct chain_record* r, const char* field)
+{
+    struct chain_field* f = find_field(&r->rec, field);
+    return f ? f->value : 0;
+}
+
+// records without key go last, equal keys keep their order
+
+int sort_cmp(const void* va, const void* vb)
+{
+    const struct entry* a = (const struct entry*) va;
+    const struct entry* b = (const struct entry*) vb;
+    int cmp;
+    
+    if(!a->key != !b->key)
+        return a->key ? -1 : 1;
+    if(a->key && (cmp = strcmp(a->key, b->key)))
+        return cmp;
+    return a->order < b->order ? -1 : a->order > b->order;
+}
+
+void heap_push(struct heap* h, struct entry* e)
+{
+    int i = h->count++, parent;
+    while(i && sort_cmp(e, &h->items[parent = (i-1)/2]) < 0)
+    {
+        h->items[i] = h->items[parent];
+        i = parent;
+    }
+    h->items[i] = *e;
+}
+
+void heap_pop(struct heap* h, struct entry* e)
+{
+    struct entry last = h->items[--h->count];
+    int i = 0, child;
+    
+    *e = h->items[0];
+    while((child = 2*i+1) < h->count)
+    {
+        if(child+1 < h->count && sort_cmp(&h->items[child+1], &h->items[child]) < 0)
+            ++child;
+        if(sort_cmp(&h->items[child], &last) >= 0)
+            break;
+        h->items[i] = h->items[child];
+        i = child;
+    }
+    h->items[i] = last;
+}
+
+void* sort_chunk(void* arg)
+{
+    struct chunk* c = (struct chunk*) arg;
+    qsort(c->entries, c->count, sizeof(struct entry), sort_cmp);
+    return 0;
+}
+
+// sorts the records of rj in parallel chunks and merges them into out
+
+int sort_run(const char* field, struct rj_stream* out, struct recordjar* rj)
+{
+    struct jar* j = (struct jar*) rj->jar;
+    struct chain_record* r;
+    struct entry* entries;
+    struct chunk* chunks;
+    struct heap h;
+    size_t count = 0, i;
+    int threads, t, ret = EXIT_SUCCESS;
+    
+    entries = (struct entry*) malloc((rj->size ? rj->size : 1)*sizeof(struct entry));
+    for(r = j->cqh_first; r != (void*)j; r = r->chain.cqe_next, ++count)
+    {
+        entries[count].key = sort_key(r, field);
+        entries[count].order = count;
+        entries[count].r = r;
+    }
+    
+    threads = sysconf(_SC_NPROCESSORS_ONLN);
+    if(threads > (int) (count/SORT_CHUNK_MIN))
+        threads = count/SORT_CHUNK_MIN;
+    if(threads < 1)
+        threads = 1;
+    
+    chunks = (struct chunk*) malloc(threads*sizeof(struct chunk));
+    for(t = 0, i = 0; t < threads; ++t)
+    {
+        chunks[t].entries = entries+i;
+        chunks[t].count = count/threads + ((size_t) t < count%threads);
+        chunks[t].pos = 0;
+        i += chunks[t].count;
+        if(t == threads-1 || pthread_create(&chunks[t].thread, 0, sort_chunk, &chunks[t]))
+        {
+            sort_chunk(&chunks[t]);
+            chunks[t].thread = pthread_self();
+        }
+    }
+    
+    h.items = (struct entry*) malloc(threads*sizeof(struct entry));
+    h.count = 0;
+    for(t = 0; t < threads; ++t)
+    {
+        if(!pthread_equal(chunks[t].thread, pthread_self()))
+            pthread_join(chunks[t].thread, 0);
+        if(chunks[t].count)
+        {
+            chunks[t].entries[0].source = t;
+            heap_push(&h, &chunks[t].entries[0]);
+        }
+    }
+    
+    while(h.count && !ret)
+    {
+        struct entry e;
+        struct chunk* c;
+        
+        heap_pop(&h, &e);
+        rj->rec = e.r;
+        ret = rj_stream_write(rj, out);
+        
+        c = &chunks[e.source];
+        if(++c->pos < c->count)
+        {
+            c->entries[c->pos].source = e.source;
+            heap_push(&h, &c->entries[c->pos]);
+        }
+    }
+    
+    free(h.items);
+    free(chunks);
+    free(entries);
+    
+    while(j->cqh_first != (void*)j)
+        free_record(rj, j->cqh_first);
+    rj->size = 0;
+    rj->rec = 0;
+    rj->field = 0;
+    return ret;
+}
+
+int merge_runs(struct rj_stream* runs, int count, const char* field, struct rj_stream* out)
+{
+    struct recordjar* jars;
+    struct heap h;
+    struct entry e;
+    int i, ret = EXIT_SUCCESS;
+    
+    jars = (struct recordjar*) malloc(count*sizeof(struct recordjar));
+    h.items = (struct entry*) malloc(count*sizeof(struct entry));
+    h.count = 0;
+    
+    for(i = 0; i < count; ++i)
+    {
+        rj_init(&jars[i]);
+        stream_rewind(&runs[i]);
+        if(!rj_stream_read(&jars[i], &runs[i]))
+        {
+            e.r = jars[i].rec;
+            e.key = sort_key(e.r, field);
+            e.order = i;
+            e.source = i;
+            heap_push(&h, &e);
+        }
+    }
+    
+    // runs hold consecutive input ranges, so their index keeps it stable
+    while(h.count && !ret)
+    {
+        struct recordjar* rj;
+        
+        heap_pop(&h, &e);
+        rj = &jars[e.source];
+        rj->rec = e.r;
+        ret = rj_stream_write(rj, out);
+        free_record(rj, e.r);
+        
+        if(!ret && !(ret = rj_stream_read(rj, &runs[e.source])))
+        {
+            e.r = rj->rec;
+            e.key = sort_key(e.r, field);
+            heap_push(&h, &e);
+        }
+        else if(ret == RJ_EOF)
+            ret = EXIT_SUCCESS;
+    }
+    
+    for(i = 0; i < count; ++i)
+        rj_free(&jars[i]);
+    free(jars);
+    free(h.items);
+    return ret;
+}
+
+// merges the last SORT_FANIN runs while they are of the same level,
+// which keeps the number of open runs logarithmic in the input size
+
+int merge_levels(struct rj_stream* runs, int* levels, int* count, const char* field)
+{
+    struct rj_stream merged;
+    int first, i, ret;
+    
+    while(*count >= SORT_FANIN)
+    {
+        first = *count - SORT_FANIN;
+        for(i = first; i < *count && levels[i] == levels[first]; ++i);
+        if(i < *count)
+            break;
+        
+        DEBUG(printf("[RJ] merge level %i\n", levels[first]));
+        FILE* fp = tmpfile();
+        if(!fp)
+            return errno;
+        stream_attach(fp, 1, &merged);
+        ret = merge_runs(runs+first, SORT_FANIN, field, &merged);
+        if(!ret && fflush(fp))
+            ret = errno;
+        
+        for(i = first; i < *count; ++i)
+            rj_stream_close(&runs[i]);
+        runs[first] = merged;
+        ++levels[first];
+        *count = first+1;
+        if(ret)
+            return ret;
+    }
+    return EXIT_SUCCESS;
+}
+
+int rj_sort_file(const char* in, const char* out, const char* field, size_t budget)
+{
+    struct rj_stream is, os, *runs = 0;
+    struct recordjar rj;
+    size_t bytes = 0;
+    int count = 0, size = 0, *levels = 0, i, ret;
+    
+    if((ret = rj_stream_open(in, "r", &is)))
+        return ret;
+    rj_init(&rj);
+    
+    while(1)
+    {
+        ret = rj_stream_read(&rj, &is);
+        if(ret && ret != RJ_EOF)
+            break;
+        if(!ret)
+            bytes += record_bytes(rj.rec);
+        
+        if(ret == RJ_EOF && !count)
+        {
+            DEBUG(printf("[RJ] sort in memory\n"));
+            if(!(ret = rj_stream_open(out, "w", &os)))
+            {
+                ret = sort_run(field, &os, &rj);
+                i = rj_stream_close(&os);
+                ret = ret ? ret : i;
+            }
+            break;
+        }
+        
+        if((ret == RJ_EOF && rj.size) || bytes >= budget)
+        {
+            DEBUG(printf("[RJ] sort run %i\n", count));
+            FILE* fp = tmpfile();
+            if(!fp)
+            {
+                ret = errno;
+                break;
+            }
+            if(count == size)
+            {
+                size = size ? 2*size : SORT_FANIN;
+                runs = (struct rj_stream*) realloc(runs, size*sizeof(struct rj_stream));
+                levels = (int*) realloc(levels, size*sizeof(int));
+            }
+            levels[count] = 0;
+            stream_attach(fp, 1, &runs[count++]);
+            if((i = sort_run(field, &runs[count-1], &rj)) || fflush(fp))
+            {
+                ret = i ? i : errno;
+                break;
+            }
+            if((i = merge_levels(runs, levels, &count, field)))
+            {
+                ret = i;
+                break;
+            }
+            bytes = 0;
+        }
+        
+        if(ret == RJ_EOF)
+        {
+            DEBUG(printf("[RJ] merge %i runs\n", count));
+            if(!(ret = rj_stream_open(out, "w", &os)))
+            {
+                ret = merge_runs(runs, count, field, &os);
+                i = rj_stream_close(&os);
+                ret = ret ? ret : i;
+            }
+            break;
+        }
+    }
+    
+    for(i = 0; i < count; ++i)
+        rj_stream_close(&runs[i]);
+    free(runs);
+    free(levels);
+    rj_free(&rj);
+    rj_stream_close(&is);
+    return ret;
+}
@@ -0,0 +1,80 @@
+/*
+ * This source file is part of the librj c library.
+ *
+ * Copyright (c) 2014 Martin Rödel aka Yomin
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#include "rj_private.h"
+#include <string.h>
+
+// 32 bit FNV-1a over field and value, separated by their NUL, with a
+// final mix so seeds yield independent hashes on every platform
+
+unsigned long static_hash(const char* field, const char* value, unsigned long seed)
+{
+    unsigned long hash = (2166136261UL ^ (seed * 2654435761UL)) & 0xffffffffUL;
+    const unsigned char* str;
+    
+    for(str = (const unsigned char*) field; ; ++str)
+    {
+        hash = ((hash ^ *str) * 16777619UL) & 0xffffffffUL;
+        if(!*str)
+            break;
+    }
+    for(str = (const unsigned char*) value; *str; ++str)
+        hash = ((hash ^ *str) * 16777619UL) & 0xffffffffUL;
+    
+    hash ^= hash >> 16;
+    hash = (hash * 0x85ebca6bUL) & 0xffffffffUL;
+    hash ^= hash >> 13;
+    hash = (hash * 0xc2b2ae35UL) & 0xffffffffUL;
+    hash ^= hash >> 16;
+    return hash;
+}
+
+const struct static_entry* static_find(const struct rj_static* s, const char* field, const char* value)
+{
+    const struct static_entry* e;
+    unsigned long i;
+    
+    if(!s->nslots)
+        return 0;
+    
+    i = s->disp[static_hash(field, value, 0) % s->buckets];
+    i = s->slots[static_hash(field, value, i) % s->nslots];
+    if(i == STATIC_EMPTY)
+        return 0;
+    
+    // keys not in the jar hash to arbitrary slots
+    e = &s->entries[i];
+    return strcmp(e->field, field) || strcmp(e->value, value) ? 0 : e;
+}
+
+// the jar is read only and must not be freed, rj_free only resets it
+
+void rj_init_static(const struct rj_static* s, struct recordjar* rj)
+{
+    memset(rj, 0, sizeof(struct recordjar));
+    rj->jar = s->jar;
+    rj->size = s->size;
+    rj->rec = s->size ? s->jar->cqh_first : 0;
+    rj->index = (void*) s;
+}
@@ -0,0 +1,144 @@
+/*
+ * This source file is part of the librj c library.
+ *
+ * Copyright (c) 2014 Martin Rödel aka Yomin
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#define _GNU_SOURCE
+
+#include "rj_private.h"
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+
+// file == 0 - stdin/stdout
+
+int rj_stream_open(const char* file, const char* mode, struct rj_stream* rs)
+{
+    int write = mode[0] == 'w' || mode[0] == 'a';
+    FILE* fp;
+    
+    if(file)
+        fp = fopen(file, mode);
+    else
+        fp = write ? stdout : stdin;
+    if(!fp)
+        return errno;
+    
+    stream_attach(fp, write, rs);
+    if(ferror(fp))
+    {
+        int ret = errno ? errno : EIO;
+        rj_stream_close(rs);
+        return ret;
+    }
+    return EXIT_SUCCESS;
+}
+
+void stream_attach(FILE* fp, int write, struct rj_stream* rs)
+{
+    struct stream* s = (struct stream*) malloc(sizeof(struct stream));
+    memset(s, 0, sizeof(struct stream));
+    s->p.fp = fp;
+    s->write = write;
+    
+    rs->count = 0;
+    rs->stream = s;
+    
+    if(write)
+        fprintf(fp, "%%%%encoding: US-ASCII\n");
+}
+
+// turns a written stream into one reading from the start
+
+void stream_rewind(struct rj_stream* rs)
+{
+    struct stream* s = (struct stream*) rs->stream;
+    
+    rewind(s->p.fp);
+    s->p.encoding = 0;
+    s->p.eof = 0;
+    s->write = 0;
+    rs->count = 0;
+}
+
+int rj_stream_read(struct recordjar* rj, struct rj_stream* rs)
+{
+    struct stream* s = (struct stream*) rs->stream;
+    struct jar* j = (struct jar*) rj->jar;
+    int ret = 0;
+    
+    if(rj->index)
+        return EROFS;
+    while(!s->p.eof)
+    {
+        struct chain_record* cr = new_record(rj);
+        CIRCLEQ_INSERT_TAIL(j, cr, chain);
+        if((ret = parse_record(&s->p, &cr->rec, 0)) > 0)
+        {
+            ++rj->size;
+            ++rs->count;
+            rj->rec = cr;
+            rj->field = 0;
+            journal_record(rj, cr);
+            return journal_error(rj);
+        }
+        free_record(rj, cr);
+        if(ret < 0)
+            return ret;
+    }
+    return ferror(s->p.fp) ? errno : RJ_EOF;
+}
+
+int rj_stream_write(struct recordjar* rj, struct rj_stream* rs)
+{
+    struct stream* s = (struct stream*) rs->stream;
+    
+    if(!rj->rec)
+        return EXIT_SUCCESS;
+    if(rs->count++)
+        fprintf(s->p.fp, "%%%%\n");
+    touch(rj, rj->rec);
+    write_record(s->p.fp, rj->rec, &s->buf, &s->len, &s->size);
+    return ferror(s->p.fp) ? errno : EXIT_SUCCESS;
+}
+
+int rj_stream_close(struct rj_stream* rs)
+{
+    struct stream* s = (struct stream*) rs->stream;
+    int ret = EXIT_SUCCESS;
+    
+    if(s->p.fp == stdin || s->p.fp == stdout)
+    {
+        if(fflush(s->p.fp))
+            ret = errno;
+    }
+    else if(fclose(s->p.fp))
+        ret = errno;
+    
+    if(s->p.line)
+        free(s->p.line);
+    if(s->buf)
+        free(s->buf);
+    free(s);
+    rs->stream = 0;
+    return ret;
+}
@@ -0,0 +1,433 @@
+/*
+ * This source file is part of the librj c library.
+ *
+ * Copyright (c) 2014 Martin Rödel aka Yomin
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#define _GNU_SOURCE
+
+#include "rj_private.h"
+#include <unistd.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <ctype.h>
+#include <errno.h>
+
+// generates C source holding a jar as static chain structures and a
+// perfect hash index over its (field, value) pairs for rj_init_static
+
+struct entry
+{
+    const char *field, *value;
+    char* key;
+    unsigned long *refs, count, bucket, slot;
+};
+
+struct gen
+{
+    const char* name;
+    struct entry* entries;
+    unsigned long count, size, buckets, nslots, *disp, *slots;
+};
+
+void usage(const char* name)
+{
+    fprintf(stderr, "Usage: %s [-n <name>] [-o <output>] [<file>]\n", name);
+    fprintf(stderr, "  -n  name of the generated struct rj_static,\n");
+    fprintf(stderr, "      derived from the file name by default\n");
+    fprintf(stderr, "  -o  file to write instead of stdout\n");
+}
+
+void print_string(const char* str)
+{
+    putchar('"');
+    for(; *str; ++str)
+    {
+        unsigned char c = *str;
+        if(c == '"' || c == '\\' || c == '?')
+            printf("\\%c", c);
+        else if(isprint(c))
+            putchar(c);
+        else
+            printf("\\%03o", c);
+    }
+    putchar('"');
+}
+
+char* derive_name(const char* file)
+{
+    const char* base = strrchr(file, '/');
+    char *name, *c;
+    
+    base = base ? base+1 : file;
+    name = (char*) malloc(strlen(base)+2);
+    sprintf(name, "%s%s", isdigit((unsigned char) *base) ? "_" : "", base);
+    if((c = strchr(name, '.')) && c != name)
+        *c = 0;
+    for(c = name; *c; ++c)
+        if(!isalnum((unsigned char) *c))
+            *c = '_';
+    return name;
+}
+
+// field names end at their first ':', so "field:value" keys are unique
+
+void add_pair(struct gen* g, struct hash* h, const char* field, const char* value, unsigned long id)
+{
+    struct hash_entry* he;
+    struct entry* e;
+    char* key;
+    
+    if(asprintf(&key, "%s:%s", field, value) == -1)
+        exit(1);
+    he = hash_get(h, key, 1);
+    if(he->value)
+    {
+        free(key);
+        e = &g->entries[(unsigned long) he->value - 1];
+        if(e->refs[e->count-1] == id)
+            return;
+    }
+    else
+    {
+        if(g->count == g->size)
+        {
+            g->size = g->size ? 2*g->size : 64;
+            g->entries = (struct entry*) realloc(g->entries, g->size*sizeof(struct entry));
+        }
+        e = &g->entries[g->count++];
+        memset(e, 0, sizeof(struct entry));
+        e->field = field;
+        e->value = value;
+        e->key = key;
+        he->value = (void*) g->count; // index + 1
+    }
+    e->refs = (unsigned long*) realloc(e->refs, (e->count+1)*sizeof(unsigned long));
+    e->refs[e->count++] = id;
+}
+
+int bucket_cmp(const void* a, const void* b)
+{
+    const unsigned long *x = (const unsigned long*) a, *y = (const unsigned long*) b;
+    return x[1] < y[1] ? 1 : x[1] > y[1] ? -1 : x[0] < y[0] ? -1 : x[0] > y[0];
+}
+
+// hash and displace: the largest buckets are placed first, each with
+// the first seed mapping all its pairs to free slots
+
+int build_index(struct gen* g)
+{
+    unsigned long *order, *pos, *first, *fill, b, i, k, d, n;
+    struct entry** members;
+    int ret;
+    
+    g->buckets = g->count/4 + 1;
+    g->nslots = g->count + g->count/4 + 1;
+    g->disp = (unsigned long*) calloc(g->buckets, sizeof(unsigned long));
+    g->slots = (unsigned long*) malloc(g->nslots*sizeof(unsigned long));
+    order = (unsigned long*) calloc(2*g->buckets, sizeof(unsigned long));
+    pos = (unsigned long*) malloc(g->count*sizeof(unsigned long));
+    members = (struct entry**) malloc((g->count ? g->count : 1)*sizeof(struct entry*));
+    first = (unsigned long*) calloc(g->buckets+1, sizeof(unsigned long));
+    fill = (unsigned long*) malloc(g->buckets*sizeof(unsigned long));
+    
+    for(i = 0; i < g->nslots; ++i)
+        g->slots[i] = STATIC_EMPTY;
+    for(b = 0; b < g->buckets; ++b)
+        order[2*b] = b;
+    for(i = 0; i < g->count; ++i)
+    {
+        struct entry* e = &g->entries[i];
+        e->bucket = static_hash(e->field, e->value, 0) % g->buckets;
+        ++order[2*e->bucket+1];
+        ++first[e->bucket+1];
+    }
+    qsort(order, g->buckets, 2*sizeof(unsigned long), bucket_cmp);
+    
+    // members are grouped by bucket once, members[first[b]] onwards
+    for(b = 0; b < g->buckets; ++b)
+    {
+        first[b+1] += first[b];
+        fill[b] = first[b];
+    }
+    for(i = 0; i < g->count; ++i)
+        members[fill[g->entries[i].bucket]++] = &g->entries[i];
+    
+    for(b = 0; b < g->buckets && order[2*b+1]; ++b)
+    {
+        struct entry** m = members + first[order[2*b]];
+        n = order[2*b+1];
+        
+        for(d = 1; ; ++d)
+        {
+            for(k = 0; k < n; ++k)
+            {
+                pos[k] = static_hash(m[k]->field, m[k]->value, d) % g->nslots;
+                if(g->slots[pos[k]] != STATIC_EMPTY)
+                    break;
+                for(i = 0; i < k && pos[i] != pos[k]; ++i);
+                if(i < k)
+                    break;
+            }
+            if(k == n)
+                break;
+            if(d > 1000000)
+                break;
+        }
+        if(k < n)
+            break;
+        
+        g->disp[order[2*b]] = d;
+        for(k = 0; k < n; ++k)
+            g->slots[pos[k]] = m[k] - g->entries;
+    }
+    
+    // a bucket is left if no seed was found for it
+    ret = b < g->buckets && order[2*b+1];
+    free(order);
+    free(pos);
+    free(members);
+    free(first);
+    free(fill);
+    return ret;
+}
+
+void print_records(struct gen* g, struct recordjar* rj)
+{
+    const char* n = g->name;
+    rj_record_t r;
+    rj_field_t f;
+    unsigned long id, k = 0, first;
+    
+    printf("static const struct chain_record %s_records[%i] =\n{\n", n, rj->size);
+    for(id = 0, r = rj_first(rj); r; r = rj_record_next(r, rj), ++id)
+    {
+        printf("    {\n");
+        printf("        .chain = {\n");
+        if(id+1 < (unsigned long) rj->size)
+            printf("            (struct chain_record*) &%s_records[%lu],\n", n, id+1);
+        else
+            printf("            (struct chain_record*) (void*) &%s_jar,\n", n);
+        if(id)
+            printf("            (struct chain_record*) &%s_records[%lu]\n", n, id-1);
+        else
+            printf("            (struct chain_record*) (void*) &%s_jar\n", n);
+        printf("        },\n");
+        
+        for(first = k, f = rj_record_fields(r, rj); f; f = rj_field_next(f))
+            ++k;
+        printf("        .rec = {\n");
+        printf("            (struct chain_field*) &%s_fields[%lu],\n", n, first);
+        printf("            (struct chain_field**) &%s_fields[%lu].chain.tqe_next\n", n, k-1);
+        printf("        },\n");
+        printf("        .id = %lu,\n", id);
+        printf("        .flags = RECORD_LOADED\n");
+        printf("    },\n");
+    }
+    printf("};\n\n");
+    
+    printf("static const struct chain_field %s_fields[%lu] =\n{\n", n, k);
+    for(id = 0, k = 0, r = rj_first(rj); r; r = rj_record_next(r, rj), ++id)
+        for(f = rj_record_fields(r, rj); f; f = rj_field_next(f), ++k)
+        {
+            printf("    {\n");
+            printf("        .chain = {\n");
+            if(rj_field_next(f))
+                printf("            (struct chain_field*) &%s_fields[%lu],\n", n, k+1);
+            else
+                printf("            0,\n");
+            if(f == rj_record_fields(r, rj))
+                printf("            (struct chain_field**) &%s_records[%lu].rec.tqh_first\n", n, id);
+            else
+                printf("            (struct chain_field**) &%s_fields[%lu].chain.tqe_next\n", n, k-1);
+            printf("        },\n");
+            printf("        .field = ");
+            print_string(rj_field_name(f));
+            printf(",\n        .value = ");
+            print_string(rj_field_value(f));
+            printf(",\n        .len = %lu\n", (unsigned long) strlen(rj_field_value(f)));
+            printf("    },\n");
+        }
+    printf("};\n\n");
+}
+
+void print_index(struct gen* g)
+{
+    const char* n = g->name;
+    unsigned long i, k, first = 0;
+    
+    printf("static const struct static_entry %s_entries[%lu] =\n{\n", n, g->count);
+    for(i = 0; i < g->count; ++i)
+    {
+        printf("    {");
+        print_string(g->entries[i].field);
+        printf(", ");
+        print_string(g->entries[i].value);
+        printf(", %lu, %lu},\n", first, g->entries[i].count);
+        first += g->entries[i].count;
+    }
+    printf("};\n\n");
+    
+    printf("static const unsigned long %s_refs[%lu] =\n{", n, first);
+    for(k = 0, i = 0; i < g->count; ++i)
+        for(first = 0; first < g->entries[i].count; ++first, ++k)
+            printf("%s%lu,", k % 16 ? " " : "\n    ", g->entries[i].refs[first]);
+    printf("\n};\n\n");
+    
+    printf("static const unsigned long %s_disp[%lu] =\n{", n, g->buckets);
+    for(i = 0; i < g->buckets; ++i)
+        printf("%s%lu,", i % 16 ? " " : "\n    ", g->disp[i]);
+    printf("\n};\n\n");
+    
+    printf("static const unsigned long %s_slots[%lu] =\n{", n, g->nslots);
+    for(i = 0; i < g->nslots; ++i)
+    {
+        if(g->slots[i] == STATIC_EMPTY)
+            printf("%sSTATIC_EMPTY,", i % 8 ? " " : "\n    ");
+        else
+            printf("%s%lu,", i % 8 ? " " : "\n    ", g->slots[i]);
+    }
+    printf("\n};\n\n");
+}
+
+int main(int argc, char* argv[])
+{
+    struct rj_stream in;
+    struct recordjar rj;
+    struct gen g;
+    struct hash h;
+    rj_record_t r;
+    rj_field_t f;
+    unsigned long id, i;
+    char* name = 0;
+    const char* output = 0;
+    int opt, ret;
+    
+    memset(&g, 0, sizeof(struct gen));
+    
+    while((opt = getopt(argc, argv, "n:o:h")) != -1)
+    {
+        switch(opt)
+        {
+            case 'n': g.name = optarg; break;
+            case 'o': output = optarg; break;
+            default: usage(argv[0]); return 1;
+        }
+    }
+    if(argc - optind > 1)
+    {
+        usage(argv[0]);
+        return 1;
+    }
+    
+    const char* file = optind < argc ? argv[optind] : 0;
+    if(!g.name)
+        g.name = name = file ? derive_name(file) : strdup("rj_static");
+    
+    if((ret = rj_stream_open(file, "r", &in)))
+    {
+        fprintf(stderr, "%s: %s: %s\n", argv[0], file ? file : "stdin", rj_strerror(ret));
+        return 1;
+    }
+    rj_init(&rj);
+    while(!(ret = rj_stream_read(&rj, &in)));
+    rj_stream_close(&in);
+    if(ret != RJ_EOF)
+    {
+        fprintf(stderr, "%s: %s: %s\n", argv[0], file ? file : "stdin", rj_strerror(ret));
+        return 1;
+    }
+    
+    hash_init(&h, 0);
+    for(id = 0, r = rj_first(&rj); r; r = rj_record_next(r, &rj), ++id)
+        for(f = rj_record_fields(r, &rj); f; f = rj_field_next(f))
+            add_pair(&g, &h, rj_field_name(f), rj_field_value(f), id);
+    if(build_index(&g))
+    {
+        fprintf(stderr, "%s: no perfect hash found\n", argv[0]);
+        return 1;
+    }
+    
+    for(i = 0, r = rj_first(&rj); r; r = rj_record_next(r, &rj))
+        for(f = rj_record_fields(r, &rj); f; f = rj_field_next(f))
+            ++i;
+    
+    // opened not before the input is processed, so only the generated
+    // source ends up in it
+    if(output && !freopen(output, "w", stdout))
+    {
+        fprintf(stderr, "%s: %s: %s\n", argv[0], output, strerror(errno));
+        return 1;
+    }
+    
+    printf("// generated by rjgen from %s\n\n", file ? file : "stdin");
+    printf("#include \"rj_private.h\"\n\n");
+    printf("#if RJ_STATIC_VERSION != %i\n", RJ_STATIC_VERSION);
+    printf("#error \"generated for another layout of the librj structures, regenerate with its rjgen\"\n");
+    printf("#endif\n\n");
+    printf("static const struct jar %s_jar;\n", g.name);
+    if(rj.size)
+    {
+        printf("static const struct chain_record %s_records[%i];\n", g.name, rj.size);
+        printf("static const struct chain_field %s_fields[%lu];\n\n", g.name, i);
+        print_records(&g, &rj);
+        printf("static const struct jar %s_jar =\n{\n", g.name);
+        printf("    (struct chain_record*) &%s_records[0],\n", g.name);
+        printf("    (struct chain_record*) &%s_records[%i]\n};\n\n", g.name, rj.size-1);
+        print_index(&g);
+        printf("const struct rj_static %s =\n{\n", g.name);
+        printf("    (struct jar*) &%s_jar,\n", g.name);
+        printf("    (struct chain_record*) %s_records,\n", g.name);
+        printf("    %i,\n", rj.size);
+        printf("    %s_entries, %s_refs, %s_disp, %s_slots,\n", g.name, g.name, g.name, g.name);
+        printf("    %lu, %lu\n};\n", g.buckets, g.nslots);
+    }
+    else
+    {
+        printf("\nstatic const struct jar %s_jar =\n{\n", g.name);
+        printf("    (struct chain_record*) (void*) &%s_jar,\n", g.name);
+        printf("    (struct chain_record*) (void*) &%s_jar\n};\n\n", g.name);
+        printf("const struct rj_static %s =\n{\n", g.name);
+        printf("    (struct jar*) &%s_jar, 0, 0, 0, 0, 0, 0, 0, 0\n};\n", g.name);
+    }
+    
+    for(i = 0; i < g.count; ++i)
+    {
+        free(g.entries[i].key);
+        free(g.entries[i].refs);
+    }
+    free(g.entries);
+    free(g.disp);
+    free(g.slots);
+    hash_free(&h);
+    rj_free(&rj);
+    free(name);
+    
+    if(fflush(stdout) || ferror(stdout))
+    {
+        fprintf(stderr, "%s: %s: %s\n", argv[0], output ? output : "stdout", strerror(errno));
+        if(output)
+            remove(output);
+        return 1;
+    }
+    return 0;
+}
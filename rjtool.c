@@ -0,0 +1,216 @@
+/*
+ * This source file is part of the librj c library.
+ *
+ * Copyright (c) 2014 Martin Rödel aka Yomin
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#define _GNU_SOURCE
+
+#include "rj.h"
+#include <unistd.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+struct filter
+{
+    char *field, *value;
+    int negate;
+};
+
+struct tool
+{
+    struct filter* filters;
+    char** fields;
+    int nfilters, nfields, count;
+};
+
+void usage(const char* name)
+{
+    fprintf(stderr, "Usage: %s [-c] [-w <filter>]... [-f <field>[,<field>]...] [<file>]...\n", name);
+    fprintf(stderr, "  -c  print number of matching records only\n");
+    fprintf(stderr, "  -w  keep records matching all filters of the form\n");
+    fprintf(stderr, "      field, !field, field=value or field!=value,\n");
+    fprintf(stderr, "      the latter requires the field with another value\n");
+    fprintf(stderr, "  -f  keep only the listed fields of every record,\n");
+    fprintf(stderr, "      records without any of them are dropped\n");
+}
+
+void add_filter(char* arg, struct tool* t)
+{
+    struct filter* f;
+    char* eq;
+    
+    t->filters = (struct filter*) realloc(t->filters, (t->nfilters+1)*sizeof(struct filter));
+    f = &t->filters[t->nfilters++];
+    f->negate = 0;
+    f->value = 0;
+    
+    if(arg[0] == '!')
+    {
+        f->negate = 1;
+        ++arg;
+    }
+    else if((eq = strchr(arg, '=')))
+    {
+        f->value = eq+1;
+        if(eq > arg && eq[-1] == '!')
+        {
+            f->negate = 1;
+            --eq;
+        }
+        *eq = 0;
+    }
+    f->field = arg;
+}
+
+void add_fields(char* arg, struct tool* t)
+{
+    char* field;
+    for(field = strtok(arg, ","); field; field = strtok(0, ","))
+    {
+        t->fields = (char**) realloc(t->fields, (t->nfields+1)*sizeof(char*));
+        t->fields[t->nfields++] = field;
+    }
+}
+
+int match(struct tool* t, struct recordjar* rj)
+{
+    int i;
+    for(i = 0; i < t->nfilters; ++i)
+    {
+        struct filter* f = &t->filters[i];
+        char* value = rj_get_only(0, 0, f->field, 0, rj);
+        int keep;
+        // field!=value requires the field with another value
+        if(!value)
+            keep = f->negate && !f->value;
+        else if(f->value)
+            keep = (strcmp(value, f->value) == 0) != f->negate;
+        else
+            keep = !f->negate;
+        if(!keep)
+            return 0;
+    }
+    return 1;
+}
+
+// removes all fields not listed, returns the number of fields left
+
+int project(struct tool* t, struct recordjar* rj)
+{
+    char *field, *value, **drop = 0;
+    int i, ndrop = 0, kept = 0;
+    
+    while(rj_next(&field, &value, rj), field)
+    {
+        for(i = 0; i < t->nfields && strcmp(field, t->fields[i]); ++i);
+        if(i < t->nfields)
+            ++kept;
+        else
+        {
+            drop = (char**) realloc(drop, (ndrop+1)*sizeof(char*));
+            drop[ndrop++] = field;
+        }
+    }
+    
+    if(kept)
+        for(i = 0; i < ndrop; ++i)
+            rj_del_field_only(0, 0, drop[i], rj);
+    
+    free(drop);
+    return kept;
+}
+
+int run(const char* file, struct rj_stream* out, struct tool* t)
+{
+    struct rj_stream in;
+    struct recordjar rj;
+    int ret;
+    
+    if((ret = rj_stream_open(file, "r", &in)))
+        return ret;
+    
+    rj_init(&rj);
+    while(!(ret = rj_stream_read(&rj, &in)))
+    {
+        if(match(t, &rj))
+        {
+            if(out)
+            {
+                if((!t->nfields || project(t, &rj)) && (ret = rj_stream_write(&rj, out)))
+                    break;
+            }
+            else
+                ++t->count;
+        }
+        rj_del_record_only(0, 0, &rj);
+    }
+    rj_free(&rj);
+    rj_stream_close(&in);
+    
+    return ret == RJ_EOF ? EXIT_SUCCESS : ret;
+}
+
+int main(int argc, char* argv[])
+{
+    struct tool t;
+    struct rj_stream out;
+    int opt, count = 0, ret = EXIT_SUCCESS;
+    
+    memset(&t, 0, sizeof(struct tool));
+    
+    while((opt = getopt(argc, argv, "cw:f:h")) != -1)
+    {
+        switch(opt)
+        {
+            case 'c': count = 1; break;
+            case 'w': add_filter(optarg, &t); break;
+            case 'f': add_fields(optarg, &t); break;
+            default: usage(argv[0]); return 1;
+        }
+    }
+    
+    if(!count && (ret = rj_stream_open(0, "w", &out)))
+    {
+        fprintf(stderr, "%s: %s\n", argv[0], rj_strerror(ret));
+        return 1;
+    }
+    
+    if(optind == argc)
+        ret = run(0, count ? 0 : &out, &t);
+    for(; optind < argc; ++optind)
+        if((ret = run(argv[optind], count ? 0 : &out, &t)))
+            break;
+    
+    if(ret)
+        fprintf(stderr, "%s: %s: %s\n", argv[0],
+            optind < argc ? argv[optind] : "stdin", rj_strerror(ret));
+    
+    if(count)
+        printf("%i\n", t.count);
+    else
+        rj_stream_close(&out);
+    
+    free(t.filters);
+    free(t.fields);
+    return ret ? 1 : 0;
+}
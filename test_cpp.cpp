@@ -0,0 +1,92 @@
+/*
+ * This source file is part of the librj c library.
+ *
+ * Copyright (c) 2014 Martin Rödel aka Yomin
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+// test of the C++ wrapper, built by the test_cpp make target
+
+#include "rj.hpp"
+#include <cstdio>
+#include <type_traits>
+
+static_assert(std::is_nothrow_move_constructible_v<rj::RecordJar>);
+static_assert(!std::is_copy_constructible_v<rj::RecordJar>);
+
+static void print(const char* expected, std::string_view actual)
+{
+    std::printf("%s: %.*s\n", expected, (int) actual.size(), actual.data());
+}
+
+int main()
+{
+    rj::RecordJar jar;
+    if(jar.load("test.rj"))
+        return 1;
+    
+    std::printf("3: %i\n", jar.size());
+    int fields = 0;
+    for(rj::Record rec : jar)
+        for(rj::Field f : rec.fields())
+            fields += !f.name().empty();
+    std::printf("9: %i\n", fields);
+    
+    std::string_view key = std::string_view("same: bla").substr(0, 4);
+    rj::Record rec = jar.find(key, "bla");
+    print("value1_r1", rec.get("field1"));
+    rec = jar.find(key, "bla", rec);
+    print("value1_r2", rec.get("field1"));
+    print("not found", rec.get("nothere", "not found"));
+    std::array<std::string_view, 3> values = rec.get(std::array<std::string_view, 3>{"asd", "field1", "none"});
+    print("qwe:123", values[0]);
+    print("value1_r2", values[1]);
+    std::printf("1: %i\n", values[2].data() == nullptr);
+    
+    // records stay valid when their jar is moved
+    rj::RecordJar moved = std::move(jar);
+    rec.set("field1", "set");
+    rec.app("field1", "appended", " ");
+    rec.add(std::string(200, 'f'), "long field");
+    print("set appended", moved.find("asd").get("field1"));
+    print("long field", rec.get(std::string(200, 'f')));
+    rec.del("field1");
+    print("deleted", rec.get("field1", "deleted"));
+    
+    moved.add("cpp", "key", "field", "value");
+    print("value", moved.find("cpp", "key").get("field"));
+    std::printf("4: %i\n", moved.size());
+    moved.find("cpp", "key").erase();
+    std::printf("3: %i\n", moved.size());
+    std::printf("0: %i\n", (bool) moved.find("cpp"));
+    std::printf("1: %i\n", moved.first().next().prev() == moved.first());
+    
+    rj::RecordJar other;
+    std::printf("0: %i\n", other.load("nonexisting.rj") == 0);
+    std::printf("0: %i\n", other.size());
+    
+    other = std::move(moved);
+    std::printf("3: %i\n", other.size());
+    std::printf("1: %i\n", other.find("asd") == rec);
+    jar = std::move(other);
+    rec.add("field1", "assigned");
+    print("assigned", jar.find("asd").get("field1"));
+    return 0;
+}